@@ -0,0 +1,55 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-call cost of generated bindings: receiver unwrapping, wrapping of
+// results, overload dispatch and conversion of JS arrays into ArrayRefs.
+
+var llvm = require('..');
+var harness = require('./harness.js');
+
+exports.run = function () {
+  var builder = new llvm.IRBuilder();
+  var i32 = llvm.Type.getInt32Ty();
+  var dbl = llvm.Type.getDoubleTy();
+
+  var params1 = [dbl];
+  var params16 = [];
+  for (var i = 0; i < 16; i++) params16.push(dbl);
+
+  return [
+    // Static method with a synthesized LLVMContext argument and a wrapped result.
+    harness.throughput("bindings/static-wrap", function () {
+      llvm.Type.getDoubleTy();
+    }),
+
+    // Instance method: unwraps the receiver and wraps the result.
+    harness.throughput("bindings/unwrap-wrap", function () {
+      builder.getInt32(42);
+    }),
+
+    // Overloaded static method that has to be resolved by argument tests.
+    harness.throughput("bindings/overload-dispatch", function () {
+      llvm.ConstantInt.get(i32, 42);
+    }),
+
+    // ArrayRefFromV8 for small and moderately sized arrays.
+    harness.throughput("bindings/arrayref-1", function () {
+      llvm.FunctionType.get(dbl, params1, false);
+    }),
+
+    harness.throughput("bindings/arrayref-16", function () {
+      llvm.FunctionType.get(dbl, params16, false);
+    })
+  ];
+};
@@ -0,0 +1,32 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput of calling JIT'd functions from JavaScript through
+// FunctionPointer.toJSFunction.
+
+var harness = require('./harness.js');
+var kernels = require('./kernels.js');
+
+exports.run = function () {
+  var mul = kernels.mul().meld();
+  var poly = kernels.poly().meld();
+  var min = kernels.min().meld();
+
+  return [
+    harness.throughput("call/mul-smi", function () { mul(3, 4); }, { iterations: 100000 }),
+    harness.throughput("call/mul-heapnumber", function () { mul(1.5, 2.5); }, { iterations: 100000 }),
+    harness.throughput("call/poly", function () { poly(0.5); }, { iterations: 100000 }),
+    harness.throughput("call/min", function () { min(1.5, 2.5); }, { iterations: 100000 })
+  ];
+};
@@ -0,0 +1,30 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compilation latency of representative melded functions: fpm.run followed
+// by getPointerToFunction, measured per function.
+
+var harness = require('./harness.js');
+var kernels = require('./kernels.js');
+
+exports.run = function () {
+  return Object.keys(kernels).map(function (name) {
+    var make = kernels[name];
+    // IR construction is measured by ir.js and is kept out of the timed
+    // region. meld() would only look up the code compiled by the first sample.
+    return harness.latency("compile/meldo-" + name, function (meldo) {
+      meldo.meldUnshared();
+    }, { samples: 50, warmup: 2, setup: make });
+  });
+};
@@ -0,0 +1,99 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//
+// Minimal benchmarking harness. Every benchmark produces a plain object
+// describing its samples so that results can be serialized as JSON and
+// compared across LLVM and node upgrades.
+//
+// There are two kinds of benchmarks:
+//     throughput: |fn| is invoked |iterations| times per sample and the result
+//                 is reported in nanoseconds per invocation;
+//     latency: |fn| is invoked once per sample and the result is reported as
+//              percentiles of individual invocation times. Optional
+//              |opts.setup| runs before every invocation outside of the
+//              timed region and its result is passed to |fn|.
+//
+
+function now() {
+  var t = process.hrtime();
+  return t[0] * 1e9 + t[1];
+}
+
+function percentile(sorted, p) {
+  if (sorted.length === 0) return 0;
+  var idx = Math.min(sorted.length - 1, Math.floor(sorted.length * p / 100));
+  return sorted[idx];
+}
+
+function summarize(name, kind, unit, samples, extra) {
+  var sorted = samples.slice().sort(function (a, b) { return a - b; });
+  var sum = 0;
+  for (var i = 0; i < sorted.length; i++) sum += sorted[i];
+
+  var result = {
+    name: name,
+    kind: kind,
+    unit: unit,
+    samples: sorted.length,
+    mean: sorted.length ? sum / sorted.length : 0,
+    min: sorted[0],
+    p50: percentile(sorted, 50),
+    p90: percentile(sorted, 90),
+    p99: percentile(sorted, 99),
+    max: sorted[sorted.length - 1]
+  };
+
+  for (var key in extra) result[key] = extra[key];
+  return result;
+}
+
+exports.throughput = function (name, fn, opts) {
+  opts = opts || {};
+  var iterations = opts.iterations || 10000;
+  var samples = opts.samples || 20;
+  var warmup = opts.warmup || 3;
+
+  for (var i = 0; i < warmup * iterations; i++) fn();
+
+  var times = [];
+  for (var s = 0; s < samples; s++) {
+    var start = now();
+    for (var i = 0; i < iterations; i++) fn();
+    times.push((now() - start) / iterations);
+  }
+
+  var result = summarize(name, "throughput", "ns/op", times, { iterations: iterations });
+  result.opsPerSecond = result.p50 > 0 ? 1e9 / result.p50 : 0;
+  return result;
+};
+
+exports.latency = function (name, fn, opts) {
+  opts = opts || {};
+  var samples = opts.samples || 100;
+  var warmup = opts.warmup || 5;
+  var setup = opts.setup || function () { };
+
+  for (var i = 0; i < warmup; i++) fn(setup());
+
+  var times = [];
+  for (var s = 0; s < samples; s++) {
+    var input = setup();
+    var start = now();
+    fn(input);
+    times.push((now() - start) / 1e3);
+  }
+
+  return summarize(name, "latency", "us", times, {});
+};
@@ -0,0 +1,66 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs all benchmark suites and prints results as JSON.
+//
+// Usage: node bench/index.js [--filter <regexp>] [--out <file>]
+
+var fs = require('fs');
+
+var suites = ['bindings', 'ir', 'compile', 'call'];
+
+var filter = null;
+var outPath = null;
+for (var i = 2; i < process.argv.length; i++) {
+  switch (process.argv[i]) {
+  case '--filter':
+    filter = new RegExp(process.argv[++i]);
+    break;
+  case '--out':
+    outPath = process.argv[++i];
+    break;
+  default:
+    console.error("Usage: %s [--filter <regexp>] [--out <file>]", process.argv[1]);
+    process.exit(1);
+  }
+}
+
+var report = {
+  timestamp: new Date().toISOString(),
+  versions: process.versions,
+  arch: process.arch,
+  platform: process.platform,
+  results: []
+};
+
+suites.forEach(function (name) {
+  var results;
+  try {
+    results = require('./' + name + '.js').run();
+  } catch (e) {
+    report.results.push({ name: name, error: String(e && e.stack || e) });
+    return;
+  }
+
+  results.forEach(function (result) {
+    if (filter === null || filter.test(result.name)) report.results.push(result);
+  });
+});
+
+var json = JSON.stringify(report, null, 2);
+if (outPath !== null) {
+  fs.writeFileSync(outPath, json + '\n');
+} else {
+  console.log(json);
+}
@@ -0,0 +1,45 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// IR construction throughput: how many instructions per second can be
+// emitted through IRBuilder bindings.
+
+var llvm = require('..');
+var harness = require('./harness.js');
+
+var INSTRUCTIONS = 1000;
+
+exports.run = function () {
+  var M = new llvm.Module('bench ir');
+  var builder = new llvm.IRBuilder();
+  var dbl = llvm.Type.getDoubleTy();
+  var ft = llvm.FunctionType.get(dbl, [dbl, dbl], false);
+
+  var result = harness.throughput("ir/build-fadd-chain", function () {
+    var f = llvm.Function.Create(ft, llvm.Function.ExternalLinkage, "bench_ir", M);
+    var args = f.getArgumentList();
+    builder.SetInsertPoint(llvm.BasicBlock.Create("entry", f));
+
+    var acc = args[0];
+    for (var i = 0; i < INSTRUCTIONS; i++) {
+      acc = builder.CreateFAdd(acc, (i & 1) ? args[1] : acc);
+    }
+    builder.CreateRet(acc);
+
+    f.eraseFromParent();
+  }, { iterations: 10, samples: 20, warmup: 1 });
+
+  result.instructionsPerSecond = result.p50 > 0 ? INSTRUCTIONS * 1e9 / result.p50 : 0;
+  return [result];
+};
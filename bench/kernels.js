@@ -0,0 +1,58 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Representative melded functions shared by compile and call benchmarks.
+
+var Meldo = require('../examples/meldo');
+
+// fmul of two numbers, the example from meldo's README.
+exports.mul = function () {
+  var meldo = new Meldo;
+  with (meldo) {
+    var x = unboxNumber(arg(0));
+    var y = unboxNumber(arg(1));
+    ret(boxNumber(fmul(x, y)));
+  }
+  return meldo;
+};
+
+// Horner evaluation of a polynomial of a single argument.
+exports.poly = function () {
+  var meldo = new Meldo;
+  with (meldo) {
+    var x = unboxNumber(arg(0));
+    var acc = literal(1);
+    for (var i = 2; i < 10; i++) acc = fadd(fmul(acc, x), literal(i));
+    ret(boxNumber(acc));
+  }
+  return meldo;
+};
+
+// min(x, y) built from a control flow diamond.
+exports.min = function () {
+  var meldo = new Meldo;
+  with (meldo) {
+    var x = unboxNumber(arg(0));
+    var y = unboxNumber(arg(1));
+    var lt, ge;
+    if_(fcmpolt(x, y),
+        function (t, f, join) { lt = currentBlock(); branch(join); },
+        function (t, f, join) { ge = currentBlock(); branch(join); });
+    var result = phi(double_ty, 2);
+    result.addIncoming(x, lt);
+    result.addIncoming(y, ge);
+    ret(boxNumber(result));
+  }
+  return meldo;
+};
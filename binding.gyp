@@ -2,10 +2,10 @@
   "targets": [
     {
       "target_name": "llvm",
-      "sources": [ "src/node-llvm.cc", "src/v8capi.cc", '<(SHARED_INTERMEDIATE_DIR)/generated-bindings.cc' ],
+      "sources": [ "src/node-llvm.cc", "src/v8capi.cc", "src/parallel-for.cc", '<(SHARED_INTERMEDIATE_DIR)/generated-bindings.cc' ],
       "dependencies": ['generated-bindings'],
       "conditions": [
-        ['OS=="win"', {}, { 'libraries': ['<!@(llvm-config --libs core engine scalaropts)'] }],
+        ['OS=="win"', {}, { 'libraries': ['<!@(llvm-config --libs core engine scalaropts ipo nativecodegen)'] }],
         ['OS=="mac"', {
           'xcode_settings': {
             'OTHER_CFLAGS': [
@@ -28,6 +28,8 @@
         'source_files': [
            'src/bindings.cc'
         ],
+        # Set to --instrument or --instrument-timing to collect binding stats.
+        'kharon_flags%': '',
       },
       'actions': [
         {
@@ -44,6 +46,7 @@
           'action': [
             'node',
             'kharon/kharon.js',
+            '<@(kharon_flags)',
             'src/bindings.cc',
             '<@(_outputs)',
             '<!@(llvm-config --cxxflags)'
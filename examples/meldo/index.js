@@ -19,9 +19,31 @@ var assert = require('assert');
 llvm.InitializeNativeTarget();
 
 var M = new llvm.Module('Meldo module');
-var ee = new llvm.EngineBuilder(M).setEngineKind(llvm.EngineKind.JIT).create();
+
+// When MELDO_PROFILE is set melded functions are registered with GDB and
+// written into perf's map file so that they show up by name in profiles.
+var profile = !!process.env.MELDO_PROFILE;
+
+// Code of all melded functions is packed into large arenas. Set
+// MELDO_HUGE_PAGES to back them with 2MB pages.
+var codePool = new llvm.CodePool({ hugePages: !!process.env.MELDO_HUGE_PAGES });
+
+var eb = new llvm.EngineBuilder(M)
+  .setEngineKind(llvm.EngineKind.JIT)
+  .setLazyCompilation(true)
+  .setCodePool(codePool);
+if (profile) eb.setTargetOptions({ NoFramePointerElim: true });
+var ee = eb.create();
 assert(ee !== null, "failed to create execution engine");
 
+var perfmap = null, gdbjit = null;
+if (profile) {
+  perfmap = new llvm.PerfMapJITEventListener();
+  ee.RegisterJITEventListener(perfmap);
+  gdbjit = new llvm.GDBJITEventListener();
+  ee.RegisterJITEventListener(gdbjit);
+}
+
 fpm = new llvm.FunctionPassManager(M);
 fpm.add(new llvm.TargetData(ee.getTargetData()));
 fpm.add(llvm.createCFGSimplificationPass());
@@ -51,9 +73,15 @@ fpm.doInitialization();
 
 // Commonly used types.
 var double_ty = llvm.Type.getDoubleTy();
+var int32_ty = llvm.Type.getInt32Ty();
+var v2f64_ty = llvm.VectorType.get(double_ty, 2);
+var v4f64_ty = llvm.VectorType.get(double_ty, 4);
+var v8i32_ty = llvm.VectorType.get(int32_ty, 8);
 var ptr_ty = llvm.Type.getInt8PtrTy();
 var ptr_ptr_ty = ptr_ty.getPointerTo();
 var args_ty = llvm.StructType.create([ptr_ty, ptr_ty.getPointerTo(), llvm.Type.getInt32Ty()], "args_ty");
+var kernel_ty = llvm.FunctionType.get(
+  llvm.Type.getVoidTy(), [ptr_ty, llvm.Type.getInt64Ty(), llvm.Type.getInt64Ty()], false);
 
 // Register global functions.
 var meldo_new_number = llvm.Function.Create(
@@ -62,30 +90,69 @@ var meldo_new_number = llvm.Function.Create(
   "v8capi_new_number",
   M);
 
+var meldo_bailout = llvm.Function.Create(
+  llvm.FunctionType.get(ptr_ptr_ty, [args_ty.getPointerTo()], false),
+  llvm.Function.ExternalLinkage,
+  "v8capi_bailout",
+  M);
+
+var meldo_heap_number_type = M.getOrInsertGlobal("v8capi_heap_number_type", llvm.Type.getInt8Ty());
+
+// Offset of the instance type byte in a Map (Internals::kMapInstanceTypeOffset).
+var kMapInstanceTypeOffset = 12;
+
 var function_id = 0;
 
+// Edge counters of functions melded with meldProfiled.
+var profiler = new llvm.EdgeProfiler();
+
 module.exports = Meldo;
-function Meldo() {
+Meldo.codePool = codePool;
+
+// When |kernel| is true the function processes a slice of a typed array
+// instead of taking JS arguments: it has void(data, begin, end) signature and
+// is compiled with meldParallel().
+function Meldo(kernel) {
   this.builder = new llvm.IRBuilder();
+  this.kernel = !!kernel;
 
   this.double_ty = double_ty;
+  this.int32_ty = int32_ty;
+  this.v2f64_ty = v2f64_ty;
+  this.v4f64_ty = v4f64_ty;
+  this.v8i32_ty = v8i32_ty;
   this.ptr_ty = ptr_ty;
   this.ptr_ptr_ty = ptr_ptr_ty;
 
   this.func = llvm.Function.Create(
-    llvm.FunctionType.get(ptr_ty, [args_ty.getPointerTo()], false),
+    this.kernel ? kernel_ty : llvm.FunctionType.get(ptr_ty, [args_ty.getPointerTo()], false),
     llvm.Function.ExternalLinkage,
-    "meldo_function_" + (function_id++),
+    (this.kernel ? "meldo_kernel_" : "meldo_function_") + (function_id++),
     M);
 
   var args = this.func.getArgumentList();
-  args[0].setName("args");
 
   this.blockId = 0;
+  this.bailout_ = null;
+  this.guards_ = 0;
+  this.stored_ = false;
 
   this.builder.SetInsertPoint(this.block());
 
-  this.args_ptr = this.builder.CreateLoad(this.builder.CreateStructGEP(args[0], 1));
+  if (this.kernel) {
+    args[0].setName("data");
+    args[1].setName("begin");
+    args[2].setName("end");
+    this.args = null;
+    // Bounds are truncated so that they can be used with for_ directly.
+    this.data = args[0];
+    this.begin = this.builder.CreateTrunc(args[1], int32_ty);
+    this.end = this.builder.CreateTrunc(args[2], int32_ty);
+  } else {
+    args[0].setName("args");
+    this.args = args[0];
+    this.args_ptr = this.builder.CreateLoad(this.builder.CreateStructGEP(args[0], 1));
+  }
 }
 
 Meldo.prototype.block = function () {
@@ -99,9 +166,61 @@ Meldo.prototype.debugbreak = function () {
   );
 };
 
-Meldo.prototype.meld = function () {
+// Optional |fallback| is a generic JS implementation of the function that is
+// called with the same receiver and arguments when a guard fails.
+// Functions identical to one melded before reuse its machine code.
+Meldo.prototype.meld = function (fallback) {
+  fpm.run(this.func);
+  return ee.getPointerToCanonicalFunction(this.func).toJSFunction(fallback);
+};
+
+// Like meld but always compiles the function, even if identical machine code
+// exists already.
+Meldo.prototype.meldUnshared = function (fallback) {
   fpm.run(this.func);
-  return ee.getPointerToFunction(this.func).toJSFunction();
+  return ee.getPointerToFunction(this.func).toJSFunction(fallback);
+};
+
+// Like meld but defers optimization and compilation until the first call.
+Meldo.prototype.meldLazy = function (fallback) {
+  return ee.getPointerToFunctionOrStub(this.func, fpm).toJSFunction(fallback);
+};
+
+// Compiles a copy of the function instrumented with counters on every
+// conditional branch. Once it has seen representative inputs meldOptimized()
+// compiles the function itself with branches weighted by collected counts so
+// that block layout and loop unrolling follow the observed profile.
+Meldo.prototype.meldProfiled = function (fallback) {
+  var profiled = profiler.instrument(this.func);
+  fpm.run(profiled);
+  return ee.getPointerToFunction(profiled).toJSFunction(fallback);
+};
+
+Meldo.prototype.meldOptimized = function (fallback) {
+  assert(profiler.annotate(this.func), "function was not melded with meldProfiled");
+  return this.meld(fallback);
+};
+
+// Array of [taken, not taken] counts of conditional branches collected by
+// the function returned from meldProfiled.
+Meldo.prototype.branchCounts = function () {
+  return profiler.countersOf(this.func);
+};
+
+// Compiles a kernel and returns function (data, begin, end, callback) that
+// runs it over elements [begin, end) of typed array |data| on all cores.
+// Optional |grain| is the number of elements processed by a single task.
+Meldo.prototype.meldParallel = function (grain) {
+  assert(this.kernel, "only kernels can be run in parallel");
+  fpm.run(this.func);
+  var fp = ee.getPointerToFunction(this.func);
+  return function (data, begin, end, callback) {
+    if (grain) {
+      fp.parallelFor(data, begin, end, grain, callback);
+    } else {
+      fp.parallelFor(data, begin, end, callback);
+    }
+  };
 };
 
 Meldo.prototype.dump = function () {
@@ -161,11 +280,51 @@ Meldo.prototype.setelement = function (obj, idx, val) {
   return this.store(val, this.elementptr(obj, idx));
 };
 
+// Pointer to the backing store of a typed array (external array elements).
+Meldo.prototype.externalData = function (obj) {
+  return this.load(this.fieldptr(this.elements(obj), 2));
+};
+
 Meldo.prototype.boxNumber = function (value) {
-  return this.load(this.builder.CreateCall(meldo_new_number, [value]));
+  var builder = this.builder;
+
+  var is_smi = this.block();
+  var is_heapnumber = this.block();
+  var join = this.block();
+
+  // Integral values that fit into int32 are tagged in-line. -0 compares equal
+  // to 0 but can't be represented as Smi so it is detected by its sign bit.
+  var int32 = builder.CreateFPToSI(value, builder.getInt32Ty());
+  var is_int32 = builder.CreateFCmpOEQ(builder.CreateSIToFP(int32, this.double_ty), value);
+  var is_minus_zero = builder.CreateAnd(
+    builder.CreateICmpEQ(int32, builder.getInt32(0)),
+    builder.CreateICmpSLT(builder.CreateBitCast(value, builder.getInt64Ty()), builder.getInt64(0)));
+
+  builder.CreateCondBr(builder.CreateAnd(is_int32, builder.CreateNot(is_minus_zero)),
+                       is_smi,
+                       is_heapnumber);
+
+  builder.SetInsertPoint(is_smi);
+  var smi_val = builder.CreateIntToPtr(
+    builder.CreateShl(builder.CreateSExt(int32, builder.getInt64Ty()), 32),
+    this.ptr_ty);
+  builder.CreateBr(join);
+
+  // Only values that really need a heap number go through V8.
+  builder.SetInsertPoint(is_heapnumber);
+  var heapnumber_val = this.load(builder.CreateCall(meldo_new_number, [value]));
+  builder.CreateBr(join);
+
+  builder.SetInsertPoint(join);
+  var phi = builder.CreatePHI(this.ptr_ty, 2);
+  phi.addIncoming(smi_val, is_smi);
+  phi.addIncoming(heapnumber_val, is_heapnumber);
+  return phi;
 };
 
-Meldo.prototype.unboxNumber = function (obj) {
+// Unbox a Smi or a heap number. Anything else fails the heap number check
+// which by default is a guard (see guard) unless |check| is given.
+Meldo.prototype.unboxNumber = function (obj, check) {
   var builder = this.builder;
 
   var is_smi = this.block();
@@ -186,28 +345,140 @@ Meldo.prototype.unboxNumber = function (obj) {
   builder.CreateBr(join);
 
   builder.SetInsertPoint(is_heapnumber);
-  // TODO(vegorov) check heap number map
+  (check || this.guard).call(this, this.hasInstanceType(obj, this.load(meldo_heap_number_type)));
   var heapnumber_val = builder.CreateLoad(builder.CreateGEP(
     builder.CreateBitCast(this.untag(obj), this.double_ty.getPointerTo()),
     builder.getInt32(1)
   ));
+  var heapnumber_block = this.currentBlock();
   builder.CreateBr(join);
 
   builder.SetInsertPoint(join);
   var phi = builder.CreatePHI(this.double_ty, 2);
   phi.addIncoming(smi_val, is_smi);
-  phi.addIncoming(heapnumber_val, is_heapnumber);
+  phi.addIncoming(heapnumber_val, heapnumber_block);
   return phi;
 };
 
+// Value of a Smi as int32.
+Meldo.prototype.untagSmi = function (obj) {
+  var builder = this.builder;
+  return builder.CreateIntCast(
+    builder.CreateAShr(builder.CreatePtrToInt(obj, builder.getInt64Ty()), 32),
+    builder.getInt32Ty(),
+    true);
+};
+
 Meldo.prototype.unboxInteger32 = function (val, check) {
   var builder = this.builder;
 
   var int32 = builder.CreateFPToSI(val, builder.getInt32Ty());
-  check(builder.CreateFCmpOEQ(builder.CreateSIToFP(int32, this.double_ty), val));
+  (check || this.guard).call(this, builder.CreateFCmpOEQ(builder.CreateSIToFP(int32, this.double_ty), val));
   return int32;
 };
 
+//
+// Speculation. Guards check assumptions made by specialized code and branch
+// to a shared bailout block when they fail. The bailout calls the generic
+// fallback given to meld() and returns its result; without a fallback
+// a failed guard throws.
+//
+// The fallback starts from scratch, so a guard must not be reached after
+// the function stored to memory: the store would happen twice. guard()
+// asserts that nothing was stored before it and loops assert that a body
+// which stores contains no guards (they would run after stores of previous
+// iterations).
+//
+// Kernels have no JS arguments to hand to a fallback and can't bail out:
+// unboxing in a kernel needs an explicit |check|.
+//
+
+Meldo.prototype.bailout = function () {
+  assert(!this.kernel, "kernels can't bail out");
+  if (this.bailout_ === null) {
+    var builder = this.builder;
+    var current = this.currentBlock();
+
+    var bailout = this.bailout_ = this.block();
+    var threw = this.block();
+    var done = this.block();
+
+    builder.SetInsertPoint(bailout);
+    var result = builder.CreateCall(meldo_bailout, [this.args]);
+    builder.CreateCondBr(builder.CreateIsNull(result), threw, done);
+
+    builder.SetInsertPoint(threw);
+    this.ret();  // Empty handle, exception is pending.
+
+    builder.SetInsertPoint(done);
+    this.ret(this.load(result));
+
+    builder.SetInsertPoint(current);
+  }
+  return this.bailout_;
+};
+
+// Continue if |cond| is true, bail out otherwise.
+Meldo.prototype.guard = function (cond) {
+  assert(!this.kernel, "kernels can't bail out, pass an explicit check");
+  assert(!this.stored_, "guard after a store: bailout would repeat the store");
+  this.guards_++;
+  var cont = this.block();
+  this.builder.CreateCondBr(cond, cont, this.bailout());
+  this.builder.SetInsertPoint(cont);
+};
+
+Meldo.prototype.isSmi = function (obj) {
+  var builder = this.builder;
+  return builder.CreateICmpEQ(
+    builder.CreateAnd(builder.CreatePtrToInt(obj, builder.getInt64Ty()), builder.getInt64(1)),
+    builder.getInt64(0));
+};
+
+// Map and instance type of a heap object. Must not be used on Smis.
+Meldo.prototype.mapOf = function (obj) {
+  return this.load(this.fieldptr(obj, 0));
+};
+
+Meldo.prototype.instanceTypeOf = function (obj) {
+  var builder = this.builder;
+  return builder.CreateLoad(
+    builder.CreateGEP(this.mapOf(obj), builder.getInt32(kMapInstanceTypeOffset - 1)));
+};
+
+Meldo.prototype.hasMap = function (obj, map) {
+  return this.builder.CreateICmpEQ(this.mapOf(obj), map);
+};
+
+Meldo.prototype.hasInstanceType = function (obj, type) {
+  return this.builder.CreateICmpEQ(this.instanceTypeOf(obj), type);
+};
+
+// Smis are 32 bit so a double is in Smi range when it is an int32.
+Meldo.prototype.inSmiRange = function (val) {
+  var builder = this.builder;
+  return builder.CreateFCmpOEQ(
+    builder.CreateSIToFP(builder.CreateFPToSI(val, builder.getInt32Ty()), this.double_ty), val);
+};
+
+Meldo.prototype.guardSmi = function (obj) {
+  this.guard(this.isSmi(obj));
+};
+
+Meldo.prototype.guardMap = function (obj, map) {
+  this.guard(this.not(this.isSmi(obj)));
+  this.guard(this.hasMap(obj, map));
+};
+
+Meldo.prototype.guardHeapNumber = function (obj) {
+  this.guard(this.not(this.isSmi(obj)));
+  this.guard(this.hasInstanceType(obj, this.load(meldo_heap_number_type)));
+};
+
+Meldo.prototype.guardSmiRange = function (val) {
+  this.guard(this.inSmiRange(val));
+};
+
 Meldo.prototype.not = function (value) {
   return this.builder.CreateNot(value);
 };
@@ -230,9 +501,20 @@ forward("icmpeq", "CreateICmpEQ");
 forward("fcmpolt", "CreateFCmpOLT");
 forward("fmul", "CreateFMul");
 forward("fadd", "CreateFAdd");
-forward("store", "CreateStore");
 forward("branch", "CreateBr");
 forward("phi", "CreatePHI")
+forward("fsub", "CreateFSub");
+forward("fdiv", "CreateFDiv");
+forward("add", "CreateAdd");
+forward("sub", "CreateSub");
+forward("mul", "CreateMul");
+forward("select", "CreateSelect");
+
+// Stores are tracked to catch guards that would repeat them, see guard.
+Meldo.prototype.store = function (value, ptr) {
+  this.stored_ = true;
+  return this.builder.CreateStore(value, ptr);
+};
 
 Meldo.prototype.if_ = function (cond, build_then, build_else) {
   var builder = this.builder;
@@ -260,7 +542,106 @@ Meldo.prototype.if_ = function (cond, build_then, build_else) {
   builder.SetInsertPoint(join);
 };
 
+// Loop with a test at the top: while (build_cond(values)) values = build_body(values).
+//
+// |init| is an array of initial values of loop-carried variables. They become
+// PHIs in the loop header which are passed to |build_cond| and |build_body|.
+// |build_body| returns an array of values for the next iteration (or nothing
+// if variables don't change) and receives a loop object that can be used to
+// exit early:
+//     loop.break_(cond, values): leave the loop if |cond| is true; optional
+//                                |values| override values of carried variables.
+//
+// Returns an array of values of the carried variables after the loop.
+//
+// The emitted loop has a preheader, a single latch and the test in the header
+// which is the shape loop rotation, LICM, induction variable simplification
+// and unrolling expect.
+Meldo.prototype.while_ = function (init, build_cond, build_body) {
+  var self = this;
+  var builder = this.builder;
+
+  var header = this.block();
+  var body = this.block();
+  var exit = this.block();
+
+  var preheader = this.currentBlock();
+  builder.CreateBr(header);
+  var guards = this.guards_;
+
+  builder.SetInsertPoint(header);
+  var phis = init.map(function (value) {
+    var phi = builder.CreatePHI(value.getType(), 2);
+    phi.addIncoming(value, preheader);
+    return phi;
+  });
+
+  // Condition may branch internally (e.g. a guard), so the exit edge comes
+  // from whatever block it finished in rather than from the header.
+  var cond = build_cond(phis);
+  var exits = [{ block: this.currentBlock(), values: phis }];
+  builder.CreateCondBr(cond, body, exit);
+
+  var loop = {
+    header: header,
+    exit: exit,
+    break_: function (cond, values) {
+      var cont = self.block();
+      exits.push({ block: self.currentBlock(), values: values || phis });
+      builder.CreateCondBr(cond, exit, cont);
+      builder.SetInsertPoint(cont);
+    }
+  };
+
+  builder.SetInsertPoint(body);
+  var next = build_body(phis, loop) || phis;
+  assert(next.length === phis.length, "loop body should produce values for all carried variables");
+  assert(!this.stored_ || this.guards_ === guards, "guard in a loop that stores: bailout would repeat earlier iterations");
+
+  var latch = this.currentBlock();
+  builder.CreateBr(header);
+  phis.forEach(function (phi, idx) { phi.addIncoming(next[idx], latch); });
+
+  builder.SetInsertPoint(exit);
+  return phis.map(function (phi, idx) {
+    var result = builder.CreatePHI(phi.getType(), exits.length);
+    exits.forEach(function (e) { result.addIncoming(e.values[idx], e.block); });
+    return result;
+  });
+};
+
+// Counted loop: for (i = from; i < to; i++) with int32 induction variable.
+// |build_body(i, values, loop)| works like in while_ with |values| and
+// the result of the loop not including the induction variable.
+Meldo.prototype.for_ = function (from, to, init, build_body) {
+  var builder = this.builder;
+
+  if (typeof from === "number") from = builder.getInt32(from | 0);
+  if (typeof to === "number") to = builder.getInt32(to | 0);
+
+  var results = this.while_([from].concat(init || []), function (values) {
+    return builder.CreateICmpSLT(values[0], to);
+  }, function (values, loop) {
+    var i = values[0];
+    var carried = values.slice(1);
+    var next = build_body(i, carried, {
+      header: loop.header,
+      exit: loop.exit,
+      break_: function (cond, values) {
+        loop.break_(cond, values ? [i].concat(values) : undefined);
+      }
+    }) || carried;
+    return [builder.CreateNSWAdd(i, builder.getInt32(1))].concat(next);
+  });
+
+  return results.slice(1);
+};
+
 Meldo.prototype.ret = function (value) {
+  if (this.kernel) {
+    this.builder.CreateRetVoid();
+    return;
+  }
   if (typeof value === "undefined") {
     value = this.builder.CreateIntToPtr(this.builder.getInt64(0), this.ptr_ty);
   }
@@ -272,3 +653,153 @@ Meldo.prototype.literal = function (value) {
   return llvm.ConstantFP.get(this.double_ty, value);
 };
 
+//
+// Vector operations. Vector values are combined with the same arithmetic
+// operations as scalars (fadd, fmul, add, ...); helpers below cover memory
+// access, lane manipulation and reductions.
+//
+
+Meldo.prototype.vectorType = function (elem_ty, lanes) {
+  return llvm.VectorType.get(elem_ty, lanes);
+};
+
+// Pointer to element |idx| of a raw array of |elem_ty| values starting at |base|.
+Meldo.prototype.dataptr = function (base, elem_ty, idx) {
+  if (typeof idx === "number") idx = this.builder.getInt32(idx | 0);
+  return this.builder.CreateGEP(this.builder.CreateBitCast(base, elem_ty.getPointerTo()), idx);
+};
+
+// Vector loads and stores only assume alignment of the element type.
+Meldo.prototype.vload = function (ptr, vec_ty) {
+  return this.builder.CreateAlignedLoad(
+    this.builder.CreateBitCast(ptr, vec_ty.getPointerTo()),
+    vec_ty.getScalarSizeInBits() / 8);
+};
+
+Meldo.prototype.vstore = function (value, ptr) {
+  var vec_ty = value.getType();
+  this.stored_ = true;  // See guard.
+  return this.builder.CreateAlignedStore(
+    value,
+    this.builder.CreateBitCast(ptr, vec_ty.getPointerTo()),
+    vec_ty.getScalarSizeInBits() / 8);
+};
+
+Meldo.prototype.extract = function (vec, lane) {
+  return this.builder.CreateExtractElement(vec, this.builder.getInt32(lane));
+};
+
+Meldo.prototype.insert = function (vec, value, lane) {
+  return this.builder.CreateInsertElement(vec, value, this.builder.getInt32(lane));
+};
+
+// Shuffle lanes of |a| and |b| (which can be omitted) according to |mask|,
+// an array of lane indices where -1 denotes undefined lane.
+Meldo.prototype.shuffle = function (a, b, mask) {
+  var int32_ty = this.int32_ty;
+  if (b === null || typeof b === "undefined") b = llvm.UndefValue.get(a.getType());
+  return this.builder.CreateShuffleVector(a, b, llvm.ConstantVector.get(mask.map(function (lane) {
+    return lane < 0 ? llvm.UndefValue.get(int32_ty) : llvm.ConstantInt.get(int32_ty, lane);
+  })));
+};
+
+Meldo.prototype.splat = function (value, lanes) {
+  var vec = this.insert(llvm.UndefValue.get(this.vectorType(value.getType(), lanes)), value, 0);
+  var mask = [];
+  for (var i = 0; i < lanes; i++) mask.push(0);
+  return this.shuffle(vec, null, mask);
+};
+
+// Horizontal reduction of all lanes of |vec| with a binary operation: either
+// a function or a name of Meldo method (e.g. "fadd"). Lanes are folded
+// pairwise in log2(lanes) steps.
+Meldo.prototype.reduce = function (vec, op) {
+  var self = this;
+  var combine = (typeof op === "function") ? op : function (a, b) { return self[op](a, b); };
+
+  // Every step folds the upper half of the live lanes onto the lower half.
+  // The mask keeps the vector width so that both operands of combine have
+  // the same type; lanes that are no longer live are undefined.
+  var width = vec.getType().getVectorNumElements();
+  for (var lanes = width; lanes > 1; lanes >>= 1) {
+    var half = lanes >> 1;
+    var mask = [];
+    for (var i = 0; i < width; i++) mask.push(i < half ? i + half : -1);
+    vec = combine(vec, this.shuffle(vec, null, mask));
+  }
+
+  return this.extract(vec, 0);
+};
+
+Meldo.prototype.reduceAdd = function (vec) {
+  return this.reduce(vec, vec.getType().isFPOrFPVectorTy() ? "fadd" : "add");
+};
+
+Meldo.prototype.reduceMul = function (vec) {
+  return this.reduce(vec, vec.getType().isFPOrFPVectorTy() ? "fmul" : "mul");
+};
+
+Meldo.prototype.reduceMin = function (vec) {
+  var builder = this.builder;
+  var fp = vec.getType().isFPOrFPVectorTy();
+  return this.reduce(vec, function (a, b) {
+    return builder.CreateSelect(fp ? builder.CreateFCmpOLT(a, b) : builder.CreateICmpSLT(a, b), a, b);
+  });
+};
+
+Meldo.prototype.reduceMax = function (vec) {
+  var builder = this.builder;
+  var fp = vec.getType().isFPOrFPVectorTy();
+  return this.reduce(vec, function (a, b) {
+    return builder.CreateSelect(fp ? builder.CreateFCmpOGT(a, b) : builder.CreateICmpSGT(a, b), a, b);
+  });
+};
+
+// Masked tails: load or store only the first |count| lanes (an i32 value
+// smaller than the number of lanes) so that the end of an array can be
+// processed without touching memory past it. Lanes that are not loaded are
+// zero. LLVM has no masked memory operations so each lane is guarded.
+Meldo.prototype.loadTail = function (ptr, vec_ty, count) {
+  var builder = this.builder;
+  var elem_ty = vec_ty.getScalarType();
+  var vec = llvm.Constant.getNullValue(vec_ty);
+
+  for (var i = 0, lanes = vec_ty.getVectorNumElements(); i < lanes; i++) {
+    var pred = this.currentBlock();
+    var load = this.block();
+    var next = this.block();
+
+    builder.CreateCondBr(builder.CreateICmpSLT(builder.getInt32(i), count), load, next);
+
+    builder.SetInsertPoint(load);
+    var loaded = this.insert(vec, this.load(this.dataptr(ptr, elem_ty, i)), i);
+    builder.CreateBr(next);
+
+    builder.SetInsertPoint(next);
+    var phi = builder.CreatePHI(vec_ty, 2);
+    phi.addIncoming(vec, pred);
+    phi.addIncoming(loaded, load);
+    vec = phi;
+  }
+
+  return vec;
+};
+
+Meldo.prototype.storeTail = function (value, ptr, count) {
+  var builder = this.builder;
+  var vec_ty = value.getType();
+  var elem_ty = vec_ty.getScalarType();
+
+  for (var i = 0, lanes = vec_ty.getVectorNumElements(); i < lanes; i++) {
+    var store = this.block();
+    var next = this.block();
+
+    builder.CreateCondBr(builder.CreateICmpSLT(builder.getInt32(i), count), store, next);
+
+    builder.SetInsertPoint(store);
+    this.store(this.extract(value, i), this.dataptr(ptr, elem_ty, i));
+    builder.CreateBr(next);
+
+    builder.SetInsertPoint(next);
+  }
+};
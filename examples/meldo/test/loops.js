@@ -0,0 +1,59 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// while_ with a condition that creates blocks of its own and an early exit
+// carrying values: the exit PHI must take its incoming edges from the block
+// the condition ended in and from the block of break_.
+
+var assert = require('assert');
+var llvm = require('llvm');
+var Meldo = require('..');
+
+// Sum of the first n (arg #1, a Smi) elements of a Float64Array (arg #0),
+// or -1 if a negative element is found first.
+var meldo = new Meldo;
+with (meldo) {
+  var data = externalData(arg(0));
+  var n = untagSmi(arg(1));
+  var results = while_([builder.getInt32(0), literal(0)], function (values) {
+    // i < n computed through a diamond so that the condition ends in a
+    // block different from the loop header.
+    var in_range, out_of_range;
+    if_(builder.CreateICmpSLT(values[0], n),
+        function (t, f, join) { in_range = currentBlock(); branch(join); },
+        function (t, f, join) { out_of_range = currentBlock(); branch(join); });
+    var cond = phi(builder.getInt1Ty(), 2);
+    cond.addIncoming(builder.getTrue(), in_range);
+    cond.addIncoming(builder.getFalse(), out_of_range);
+    return cond;
+  }, function (values, loop) {
+    var x = load(dataptr(data, double_ty, values[0]));
+    loop.break_(fcmpolt(x, literal(0)), [values[0], literal(-1)]);
+    return [add(values[0], builder.getInt32(1)), fadd(values[1], x)];
+  });
+  ret(boxNumber(results[1]));
+}
+
+// Returns true if the function is broken.
+assert(!llvm.verifyFunction(meldo.func, llvm.VerifierFailureAction.PrintMessageAction));
+
+var sum = meldo.meld();
+assert.equal(sum(new Float64Array([1, 2, 3, 4]), 4), 10);
+assert.equal(sum(new Float64Array([1, 2, 3, 4]), 2), 3);
+assert.equal(sum(new Float64Array([1, 2, 3, 4]), 0), 0);
+assert.equal(sum(new Float64Array([1, -5, 3]), 3), -1);
+assert.equal(sum(new Float64Array([1, -5, 3]), 1), 1);
+
+console.log("ok");
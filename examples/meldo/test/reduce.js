@@ -0,0 +1,51 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Horizontal reductions of 4 and 8 lane vectors loaded from typed arrays.
+
+var assert = require('assert');
+var llvm = require('llvm');
+var Meldo = require('..');
+
+function reduction(vec_ty, elem_ty, reduce) {
+  var meldo = new Meldo;
+  with (meldo) {
+    var vec = vload(dataptr(externalData(arg(0)), elem_ty, 0), vec_ty);
+    var result = meldo[reduce](vec);
+    if (elem_ty.isIntegerTy()) result = builder.CreateSIToFP(result, double_ty);
+    ret(boxNumber(result));
+  }
+  return meldo.meld();
+}
+
+// Types come from LLVM directly: a Meldo created only for its types would
+// leave an unterminated function in the shared module.
+var double_ty = llvm.Type.getDoubleTy();
+var int32_ty = llvm.Type.getInt32Ty();
+var v4f64_ty = llvm.VectorType.get(double_ty, 4);
+var v8i32_ty = llvm.VectorType.get(int32_ty, 8);
+
+var doubles = new Float64Array([1, 2, 3, 4]);
+assert.equal(reduction(v4f64_ty, double_ty, "reduceAdd")(doubles), 10);
+assert.equal(reduction(v4f64_ty, double_ty, "reduceMul")(doubles), 24);
+assert.equal(reduction(v4f64_ty, double_ty, "reduceMin")(doubles), 1);
+assert.equal(reduction(v4f64_ty, double_ty, "reduceMax")(doubles), 4);
+
+var ints = new Int32Array([3, -1, 4, 1, 5, -9, 2, 6]);
+assert.equal(reduction(v8i32_ty, int32_ty, "reduceAdd")(ints), 11);
+assert.equal(reduction(v8i32_ty, int32_ty, "reduceMin")(ints), -9);
+assert.equal(reduction(v8i32_ty, int32_ty, "reduceMax")(ints), 6);
+
+console.log("ok");
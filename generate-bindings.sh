@@ -14,5 +14,5 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
-node kharon/kharon.js src/bindings.cc src/generated-bindings.cc `llvm-config --cxxflags`
+node kharon/kharon.js "$@" src/bindings.cc src/generated-bindings.cc `llvm-config --cxxflags`
 
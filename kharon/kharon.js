@@ -28,12 +28,31 @@ var indent = 0;
 var prefixes = ["", "  "];
 
 var scriptPath = process.argv[1]
-var inputPath = process.argv[2];
-var outputPath = process.argv[3];
-var llvmargs = process.argv.slice(4);
+var argv = process.argv.slice(2);
+
+// --instrument makes every generated binding count its calls,
+// --instrument-timing additionally measures cycles spent in it.
+// Results are available through llvm.getBindingStats().
+var instrument = false;
+var instrumentTiming = false;
+while (argv.length > 0 && argv[0].indexOf('--') === 0) {
+  var flag = argv.shift();
+  if (flag === '--instrument') {
+    instrument = true;
+  } else if (flag === '--instrument-timing') {
+    instrument = instrumentTiming = true;
+  } else {
+    console.error("Unknown flag %s", flag);
+    process.exit(1);
+  }
+}
+
+var inputPath = argv[0];
+var outputPath = argv[1];
+var llvmargs = argv.slice(2);
 
 if (!inputPath || !outputPath || !llvmargs.length) {
-  console.error("Usage: %s <inputfile> <outputfile> <llvmargs>", scriptPath);
+  console.error("Usage: %s [--instrument | --instrument-timing] <inputfile> <outputfile> <llvmargs>", scriptPath);
   process.exit(0);
 }
 
@@ -52,6 +71,8 @@ function __ (/* fmt, args */) {
   if (str[str.length - 1] === "{") indent++;
 }
 
+if (instrument) out.write("#define KHARON_INSTRUMENT 1\n");
+if (instrumentTiming) out.write("#define KHARON_INSTRUMENT_TIMING 1\n");
 out.write(fs.readFileSync(inputPath));
 
 out.write("\n// AUTOGENERATED FILE. DO NOT EDIT!\n\n");
@@ -62,6 +83,10 @@ var tu = libclang.Parse(['-x',
                          'c++',
                          inputPath,
                          '-I' + NODE_INCLUDE_DIR].concat(llvmargs));
+tu.diagnostics().forEach(function (diagnostic) {
+  console.error(diagnostic.formatted);
+});
+
 var root = tu.cursor();
 
 var classes2bind = [];
@@ -203,6 +228,18 @@ classes.forEach(function (clazz) {
     }
     return Cursor.VisitContinue;
   });
+
+  // Manually bound methods do not need a native counterpart: function
+  // Class_method that does not correspond to any public method of the
+  // class is bound as an additional instance method.
+  var prefix = clazz.name + "_";
+  Object.keys(global_functions).forEach(function (fname) {
+    if (fname.indexOf(prefix) !== 0) return;
+    var name = fname.slice(prefix.length);
+    if (!(name in clazz.methods)) {
+      clazz.methods[name] = [new Method(name, false, false, null, null)];
+    }
+  });
 });
 
 var LLVMNamespace = {
@@ -245,6 +282,15 @@ root.visit(function (cursor) {
   return Cursor.VisitContinue;
 });
 
+// Function LLVM_name defined in the bindings source is exported as global
+// function |name| even if llvm namespace has no function with such name.
+Object.keys(global_functions).forEach(function (fname) {
+  var match = /^LLVM_(\w+)$/.exec(fname);
+  if (match !== null && !(match[1] in LLVMNamespace.methods)) {
+    LLVMNamespace.methods[match[1]] = [new Method(match[1], false, true, null, null)];
+  }
+});
+
 function emitMethodCall(host, method, args) {
   var idx = 0;
   var margs = [];
@@ -351,6 +397,7 @@ function emitAllBoundMethods(host) {
     }
 
     __ ("static v8::Handle<v8::Value> %s (const v8::Arguments& args) {", method_name);
+    if (instrument) __ ("BINDING_STATS(%s);", method_name);
     emitOverloadSelection(host, methods);
     __ ("}");
   });
@@ -210,7 +210,7 @@ var ArrayRef = marshaler({
   id:     "${actual.definition().usr()}",
   toV8:   "ArrayRefToV8<${actual.display()}>($val, ${clazz.name})",
   fromV8: "ArrayRefFromV8<${actual.display()}>($val, ${clazz.name})",
-  test:   "IS_ARRAYREF($val)"
+  test:   "IS_ARRAYREF($val, ${clazz.name})"
 });
 
 var Enum = exports.Enum = marshaler({
@@ -17,7 +17,9 @@
 #include "clang-c/Index.h"
 
 #include <climits>
-#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
 
 class StringValue {
  public:
@@ -33,23 +35,12 @@ class StringValue {
   CXString str_;
 };
 
-template<typename T>
-class Wrapper {
+class WrapperBase {
  public:
-  v8::Handle<v8::Object> Wrap(const T& val) {
-    v8::HandleScope scope;
-    v8::Handle<v8::Object> obj = ctor_->NewInstance();
-    T* pval = new T(val);
-    obj->SetPointerInInternalField(0, pval);
-    v8::Persistent<v8::Object> weak = v8::Persistent<v8::Object>::New(obj);
-    weak.MakeWeak(pval, &Dtor);
-    weak.MarkIndependent();
-    return scope.Close(obj);
-  }
+  explicit WrapperBase(int field_count) : field_count_(field_count) { }
 
-  const T& Unwrap(v8::Handle<v8::Value> value) {
-    assert(template_->HasInstance(value));
-    return *static_cast<T*>(v8::Handle<v8::Object>::Cast(value)->GetPointerFromInternalField(0));
+  bool Is(v8::Handle<v8::Value> value) {
+    return Template()->HasInstance(value);
   }
 
   v8::Handle<v8::FunctionTemplate> Template() {
@@ -68,24 +59,88 @@ class Wrapper {
     return Template()->PrototypeTemplate();
   }
 
- private:
+ protected:
   void Init() {
     template_ = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New());
-    template_->InstanceTemplate()->SetInternalFieldCount(1);
+    template_->InstanceTemplate()->SetInternalFieldCount(field_count_);
+  }
+
+  int field_count_;
+  v8::Persistent<v8::FunctionTemplate> template_;
+  v8::Persistent<v8::Function> ctor_;
+};
+
+// Wraps a heap allocated copy of the value that is deleted when the wrapper dies.
+template<typename T>
+class Wrapper : public WrapperBase {
+ public:
+  Wrapper() : WrapperBase(1) { }
+
+  v8::Handle<v8::Object> Wrap(const T& val) {
+    v8::HandleScope scope;
+    v8::Handle<v8::Object> obj = Constructor()->NewInstance();
+    T* pval = new T(val);
+    obj->SetPointerInInternalField(0, pval);
+    v8::Persistent<v8::Object> weak = v8::Persistent<v8::Object>::New(obj);
+    weak.MakeWeak(pval, &Dtor);
+    weak.MarkIndependent();
+    return scope.Close(obj);
   }
 
+  const T& Unwrap(v8::Handle<v8::Value> value) {
+    assert(template_->HasInstance(value));
+    return *static_cast<T*>(v8::Handle<v8::Object>::Cast(value)->GetPointerFromInternalField(0));
+  }
+
+ private:
   static void Dtor(v8::Persistent<v8::Value> obj, void* ptr) {
     obj.Dispose();
     obj.Clear();
     delete static_cast<T*>(ptr);
   }
+};
 
-  v8::Persistent<v8::FunctionTemplate> template_;
-  v8::Persistent<v8::Function> ctor_;
+// Wraps small POD values (cursors and types) by copying them into internal
+// fields of the wrapper as 32-bit integers. Such fields hold Smis so wrapping
+// allocates nothing but the wrapper itself and needs no weak callback, which
+// matters when millions of cursors are created while traversing an AST.
+template<typename T>
+class InlineWrapper : public WrapperBase {
+ public:
+  InlineWrapper() : WrapperBase(kFieldCount) { }
+
+  v8::Handle<v8::Object> Wrap(const T& val) {
+    v8::HandleScope scope;
+    v8::Handle<v8::Object> obj = Constructor()->NewInstance();
+    Fields fields;
+    fields.val = val;
+    for (int i = 0; i < kFieldCount; i++) {
+      obj->SetInternalField(i, v8::Integer::New(fields.words[i]));
+    }
+    return scope.Close(obj);
+  }
+
+  T Unwrap(v8::Handle<v8::Value> value) {
+    assert(template_->HasInstance(value));
+    v8::Handle<v8::Object> obj = v8::Handle<v8::Object>::Cast(value);
+    Fields fields;
+    for (int i = 0; i < kFieldCount; i++) {
+      fields.words[i] = obj->GetInternalField(i)->Int32Value();
+    }
+    return fields.val;
+  }
+
+ private:
+  static const int kFieldCount = (sizeof(T) + sizeof(int32_t) - 1) / sizeof(int32_t);
+
+  union Fields {
+    T val;
+    int32_t words[kFieldCount];
+  };
 };
 
-Wrapper<CXCursor> Cursor;
-Wrapper<CXType> Type;
+InlineWrapper<CXCursor> Cursor;
+InlineWrapper<CXType> Type;
 
 struct VisitorData {
   v8::Handle<v8::Function> callback_;
@@ -149,6 +204,16 @@ SIMPLE_METHOD0(CursorUnderlyingType, Type.Wrap, clang_getTypedefDeclUnderlyingTy
 SIMPLE_METHOD0(CursorSpecialized, Cursor.Wrap, clang_getSpecializedCursorTemplate, Cursor.Unwrap)
 SIMPLE_METHOD0(CursorIsNull, v8::Boolean::New, clang_Cursor_isNull, Cursor.Unwrap)
 
+static v8::Handle<v8::Value> CursorEquals(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  assert(args.Length() == 1);
+  if (!Cursor.Is(args[0])) return v8::False();
+  return scope.Close(v8::Boolean::New(
+      clang_equalCursors(Cursor.Unwrap(args.This()), Cursor.Unwrap(args[0])) != 0));
+}
+
+SIMPLE_METHOD0(CursorHash, v8::Integer::NewFromUnsigned, clang_hashCursor, Cursor.Unwrap)
+
 #define BIND(proto, name, func) (proto)->Set(v8::String::New(#name), v8::FunctionTemplate::New(&func))
 
 #define BINDCONST(t, name, value) (t)->Set(v8::String::New(#name), v8::Integer::New(value))
@@ -169,6 +234,8 @@ static v8::Handle<v8::Function> RegisterCursor() {
   BIND(Cursor.Prototype(), underlyingType, CursorUnderlyingType);
   BIND(Cursor.Prototype(), specialized, CursorSpecialized);
   BIND(Cursor.Prototype(), isNull, CursorIsNull);
+  BIND(Cursor.Prototype(), equals, CursorEquals);
+  BIND(Cursor.Prototype(), hash, CursorHash);
 
   /*
   ** Generated with:
@@ -375,6 +442,14 @@ COMPLEX_METHOD0(TypeArgs, v8::Handle<v8::Value>, v8::Handle<v8::Value>, { \
 
 SIMPLE_METHOD0(TypeIsVariadic, v8::Boolean::New, clang_isFunctionTypeVariadic, Type.Unwrap);
 
+static v8::Handle<v8::Value> TypeEquals(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  assert(args.Length() == 1);
+  if (!Type.Is(args[0])) return v8::False();
+  return scope.Close(v8::Boolean::New(
+      clang_equalTypes(Type.Unwrap(args.This()), Type.Unwrap(args[0])) != 0));
+}
+
 static v8::Handle<v8::Function> RegisterType() {
   v8::HandleScope scope;
   BIND(Type.Prototype(), declaration, TypeDeclaration);
@@ -385,6 +460,7 @@ static v8::Handle<v8::Function> RegisterType() {
   BIND(Type.Prototype(), pointee, TypePointee);
   BIND(Type.Prototype(), spelling, TypeSpelling);
   BIND(Type.Prototype(), isVariadic, TypeIsVariadic);
+  BIND(Type.Prototype(), equals, TypeEquals);
 
   /*
   ** Generated with:
@@ -473,76 +549,273 @@ COMPLEX_METHOD0(ContextCursor,
                 const Context&,
                 ContextT.Unwrap);
 
-static v8::Handle<v8::Function> RegisterContext() {
+// Diagnostics of a translation unit as an array of objects with severity,
+// spelling (message without location), file, line, column and the message
+// formatted the way clang prints it.
+static v8::Handle<v8::Value> ContextDiagnostics(const v8::Arguments& args) {
   v8::HandleScope scope;
-  BIND(ContextT.Prototype(), cursor, ContextCursor);
-  return ContextT.Constructor();
+  assert(args.Length() == 0);
+
+  CXTranslationUnit tu = ContextT.Unwrap(args.This()).tu();
+  unsigned n = clang_getNumDiagnostics(tu);
+  v8::Local<v8::Array> result = v8::Array::New(n);
+  for (unsigned i = 0; i < n; i++) {
+    CXDiagnostic diag = clang_getDiagnostic(tu, i);
+
+    CXFile file;
+    unsigned line, column, offset;
+    clang_getSpellingLocation(clang_getDiagnosticLocation(diag), &file, &line, &column, &offset);
+
+    v8::Local<v8::Object> obj = v8::Object::New();
+    obj->Set(v8::String::NewSymbol("severity"), v8::Integer::New(clang_getDiagnosticSeverity(diag)));
+    obj->Set(v8::String::NewSymbol("spelling"), *StringValue(clang_getDiagnosticSpelling(diag)));
+    if (file != NULL) {
+      obj->Set(v8::String::NewSymbol("file"), *StringValue(clang_getFileName(file)));
+    } else {
+      obj->Set(v8::String::NewSymbol("file"), v8::Null());
+    }
+    obj->Set(v8::String::NewSymbol("line"), v8::Integer::NewFromUnsigned(line));
+    obj->Set(v8::String::NewSymbol("column"), v8::Integer::NewFromUnsigned(column));
+    obj->Set(v8::String::NewSymbol("formatted"),
+             *StringValue(clang_formatDiagnostic(diag, clang_defaultDiagnosticDisplayOptions())));
+    result->Set(i, obj);
+
+    clang_disposeDiagnostic(diag);
+  }
+  return scope.Close(result);
 }
 
 
-class String {
+// Preorder traversal of a translation unit that runs on the main thread in
+// steps of |batch_size| cursors from a libuv idle handle, so that the event
+// loop keeps serving other requests in between. Each step passes an array of
+// cursors and an array of their parents to |on_batch|; returning false from
+// it stops the traversal. |on_done| is called at the end.
+class Traversal {
  public:
-  String() : str_(NULL) { }
-  ~String() { delete[] str_; }
-
-  void Copy(const char* str, int length) {
-    str_ = new char[length + 1];
-    strncpy(str_, str, length);
-    str_[length] = '\0';
+  static void Start(v8::Handle<v8::Object> context,
+                    CXCursor root,
+                    unsigned batch_size,
+                    v8::Handle<v8::Function> on_batch,
+                    v8::Handle<v8::Function> on_done) {
+    Traversal* traversal = new Traversal();
+    traversal->context_ = v8::Persistent<v8::Object>::New(context);
+    traversal->on_batch_ = v8::Persistent<v8::Function>::New(on_batch);
+    traversal->on_done_ = v8::Persistent<v8::Function>::New(on_done);
+    traversal->batch_size_ = batch_size;
+    PushChildren(&traversal->stack_, root);
+
+    uv_idle_init(uv_default_loop(), &traversal->idle_);
+    traversal->idle_.data = traversal;
+    uv_idle_start(&traversal->idle_, &Step);
   }
 
-  const char* str() { return str_; }
  private:
-  char* str_;
+  typedef std::vector<std::pair<CXCursor, CXCursor> > Stack;
+
+  static CXChildVisitResult CollectChild(CXCursor cursor, CXCursor parent, CXClientData data) {
+    static_cast<Stack*>(data)->push_back(std::make_pair(cursor, parent));
+    return CXChildVisit_Continue;
+  }
+
+  // Children are pushed in reverse so that they are popped in source order.
+  static void PushChildren(Stack* stack, CXCursor cursor) {
+    Stack children;
+    clang_visitChildren(cursor, &CollectChild, &children);
+    stack->insert(stack->end(), children.rbegin(), children.rend());
+  }
+
+  static void Step(uv_idle_t* handle, int status) {
+    Traversal* traversal = static_cast<Traversal*>(handle->data);
+    v8::HandleScope scope;
+
+    unsigned count = 0;
+    v8::Local<v8::Array> cursors = v8::Array::New();
+    v8::Local<v8::Array> parents = v8::Array::New();
+    while (count < traversal->batch_size_ && !traversal->stack_.empty()) {
+      std::pair<CXCursor, CXCursor> top = traversal->stack_.back();
+      traversal->stack_.pop_back();
+      PushChildren(&traversal->stack_, top.first);
+      cursors->Set(count, Cursor.Wrap(top.first));
+      parents->Set(count, Cursor.Wrap(top.second));
+      count++;
+    }
+
+    if (count > 0) {
+      v8::Handle<v8::Value> argv[2] = { cursors, parents };
+      v8::Handle<v8::Value> result =
+          node::MakeCallback(traversal->context_, traversal->on_batch_, 2, argv);
+      if (!result.IsEmpty() && result->IsFalse()) traversal->stack_.clear();
+    }
+
+    if (traversal->stack_.empty()) {
+      uv_idle_stop(&traversal->idle_);
+      node::MakeCallback(traversal->context_, traversal->on_done_, 0, NULL);
+      uv_close(reinterpret_cast<uv_handle_t*>(&traversal->idle_), &Close);
+    }
+  }
+
+  static void Close(uv_handle_t* handle) {
+    Traversal* traversal = static_cast<Traversal*>(handle->data);
+    traversal->context_.Dispose();
+    traversal->on_batch_.Dispose();
+    traversal->on_done_.Dispose();
+    delete traversal;
+  }
+
+  uv_idle_t idle_;
+  Stack stack_;
+  unsigned batch_size_;
+  // Keeps the translation unit alive while it is traversed.
+  v8::Persistent<v8::Object> context_;
+  v8::Persistent<v8::Function> on_batch_;
+  v8::Persistent<v8::Function> on_done_;
 };
 
-static v8::Handle<v8::Value> Parse(const v8::Arguments& args) {
+
+static v8::Handle<v8::Value> ContextTraverse(const v8::Arguments& args) {
   v8::HandleScope scope;
+  if (args.Length() != 3 || !args[0]->IsUint32() || args[0]->Uint32Value() == 0 ||
+      !args[1]->IsFunction() || !args[2]->IsFunction()) {
+    return v8::ThrowException(v8::Exception::Error(
+        v8::String::New("expected batch size, batch callback and done callback")));
+  }
 
-  int argc;
+  Traversal::Start(args.This(),
+                   clang_getTranslationUnitCursor(ContextT.Unwrap(args.This()).tu()),
+                   args[0]->Uint32Value(),
+                   v8::Handle<v8::Function>::Cast(args[1]),
+                   v8::Handle<v8::Function>::Cast(args[2]));
+  return v8::Undefined();
+}
 
-  v8::Handle<v8::Array> arr;
-  if (args.Length() == 1 && args[0]->IsArray()) {
-    arr = v8::Handle<v8::Array>::Cast(args[0]);
-    argc = arr->Length();
-  } else {
-    argc = args.Length();
-  }
 
-  String* strargs = new String[argc];
-  for (int i = 0; i < argc; i++) {
-    v8::String::AsciiValue arg(arr.IsEmpty() ? args[i] : arr->Get(i));
-    if (arg.length() == 0) {
-      delete[] strargs;
-      return v8::ThrowException(v8::Exception::Error(v8::String::New("expected string arguments")));
+static v8::Handle<v8::Function> RegisterContext() {
+  v8::HandleScope scope;
+  BIND(ContextT.Prototype(), cursor, ContextCursor);
+  BIND(ContextT.Prototype(), diagnostics, ContextDiagnostics);
+  BIND(ContextT.Prototype(), traverse, ContextTraverse);
+  return ContextT.Constructor();
+}
+
+
+// Command line of a parse request copied out of V8 so that it can be used
+// off the main thread.
+class CommandLine {
+ public:
+  // Accepts either an array of strings or strings as separate arguments,
+  // ignoring the last |skip| arguments.
+  bool Init(const v8::Arguments& args, int skip) {
+    v8::Handle<v8::Array> arr;
+    int argc;
+    if (args.Length() == 1 + skip && args[0]->IsArray()) {
+      arr = v8::Handle<v8::Array>::Cast(args[0]);
+      argc = arr->Length();
+    } else {
+      argc = args.Length() - skip;
     }
-    strargs[i].Copy(*arg, arg.length());
+
+    for (int i = 0; i < argc; i++) {
+      v8::String::AsciiValue arg(arr.IsEmpty() ? args[i] : arr->Get(i));
+      if (arg.length() == 0) return false;
+      args_.push_back(std::string(*arg, arg.length()));
+    }
+    return true;
   }
 
-  const char** argv = new const char* [argc];
-  for (int i = 0; i < argc; i++) {
-    argv[i] = strargs[i].str();
+  // Returns NULL if parsing failed. Diagnostics are kept in the result
+  // instead of being printed.
+  CXTranslationUnit Parse(CXIndex index) const {
+    std::vector<const char*> argv;
+    for (size_t i = 0; i < args_.size(); i++) argv.push_back(args_[i].c_str());
+    return clang_parseTranslationUnit(index, 0, argv.empty() ? NULL : &argv[0], argv.size(),
+                                      0, 0, CXTranslationUnit_None);
   }
 
-  CXIndex index = clang_createIndex(0, 0);
-  CXTranslationUnit tu = clang_parseTranslationUnit(index, 0, argv, argc, 0, 0, CXTranslationUnit_None);
+ private:
+  std::vector<std::string> args_;
+};
 
-  delete[] argv;
-  delete[] strargs;
 
+static v8::Handle<v8::Value> Parse(const v8::Arguments& args) {
+  v8::HandleScope scope;
+
+  CommandLine command_line;
+  if (!command_line.Init(args, 0)) {
+    return v8::ThrowException(v8::Exception::Error(v8::String::New("expected string arguments")));
+  }
+
+  CXIndex index = clang_createIndex(0, 0);
+  CXTranslationUnit tu = command_line.Parse(index);
   if (tu == NULL) {
     clang_disposeIndex(index);
     return v8::ThrowException(v8::Exception::Error(v8::String::New("failed to parse translation unit")));
   }
 
-  for (unsigned i = 0, n = clang_getNumDiagnostics(tu); i != n; ++i) {
-    CXString str = clang_formatDiagnostic(
-        clang_getDiagnostic(tu, i), clang_defaultDiagnosticDisplayOptions());
-    fprintf(stderr, "%s\n", clang_getCString(str));
-    clang_disposeString(str);
+  return scope.Close(ContextT.Wrap(Context(index, tu)));
+}
+
+
+// Parses a translation unit on the libuv thread pool. Every request gets its
+// own index so requests can run concurrently.
+struct ParseRequest {
+  uv_work_t work;
+  CommandLine command_line;
+  CXIndex index;
+  CXTranslationUnit tu;
+  v8::Persistent<v8::Function> callback;
+};
+
+
+static void ParseWork(uv_work_t* work) {
+  ParseRequest* request = static_cast<ParseRequest*>(work->data);
+  request->index = clang_createIndex(0, 0);
+  request->tu = request->command_line.Parse(request->index);
+}
+
+
+static void AfterParse(uv_work_t* work) {
+  ParseRequest* request = static_cast<ParseRequest*>(work->data);
+  v8::HandleScope scope;
+
+  v8::Handle<v8::Value> argv[2];
+  if (request->tu == NULL) {
+    clang_disposeIndex(request->index);
+    argv[0] = v8::Exception::Error(v8::String::New("failed to parse translation unit"));
+    argv[1] = v8::Undefined();
+  } else {
+    argv[0] = v8::Null();
+    argv[1] = ContextT.Wrap(Context(request->index, request->tu));
   }
 
-  return scope.Close(ContextT.Wrap(Context(index, tu)));
+  node::MakeCallback(v8::Context::GetCurrent()->Global(), request->callback, 2, argv);
+  request->callback.Dispose();
+  delete request;
+}
+
+
+// ParseAsync(args..., callback) takes the same arguments as Parse followed by
+// a callback that receives an error or the translation unit.
+static v8::Handle<v8::Value> ParseAsync(const v8::Arguments& args) {
+  v8::HandleScope scope;
+
+  if (args.Length() < 2 || !args[args.Length() - 1]->IsFunction()) {
+    return v8::ThrowException(v8::Exception::Error(v8::String::New("expected callback as the last argument")));
+  }
+
+  ParseRequest* request = new ParseRequest();
+  if (!request->command_line.Init(args, 1)) {
+    delete request;
+    return v8::ThrowException(v8::Exception::Error(v8::String::New("expected string arguments")));
+  }
+  request->index = NULL;
+  request->tu = NULL;
+  request->callback = v8::Persistent<v8::Function>::New(
+      v8::Handle<v8::Function>::Cast(args[args.Length() - 1]));
+  request->work.data = request;
+  uv_queue_work(uv_default_loop(), &request->work, &ParseWork, &AfterParse);
+
+  return v8::Undefined();
 }
 
 
@@ -552,6 +825,15 @@ static void Register(v8::Handle<v8::Object> exports) {
   exports->Set(v8::String::New("Type"), RegisterType());
   RegisterContext();
   exports->Set(v8::String::New("Parse"), v8::FunctionTemplate::New(&Parse)->GetFunction());
+  exports->Set(v8::String::New("ParseAsync"), v8::FunctionTemplate::New(&ParseAsync)->GetFunction());
+
+  v8::Local<v8::Object> diagnostic = v8::Object::New();
+  BINDCONST(diagnostic, Ignored, CXDiagnostic_Ignored);
+  BINDCONST(diagnostic, Note, CXDiagnostic_Note);
+  BINDCONST(diagnostic, Warning, CXDiagnostic_Warning);
+  BINDCONST(diagnostic, Error, CXDiagnostic_Error);
+  BINDCONST(diagnostic, Fatal, CXDiagnostic_Fatal);
+  exports->Set(v8::String::New("Diagnostic"), diagnostic);
 }
 
 NODE_MODULE(libclang, Register);
@@ -0,0 +1,87 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BINDING_STATS_H
+#define BINDING_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Call counters (and optionally cycle timers) for generated bindings.
+// Kharon emits BINDING_STATS(Name) at the start of every generated binding
+// and defines KHARON_INSTRUMENT and KHARON_INSTRUMENT_TIMING when it is run
+// with --instrument and --instrument-timing respectively.
+
+namespace util {
+
+struct BindingStats {
+  const char* name;
+  uint64_t calls;
+  uint64_t cycles;
+  bool registered;
+  BindingStats* next;
+};
+
+// Bindings that were called at least once, most recently registered first.
+inline BindingStats*& BindingStatsList() {
+  static BindingStats* head = NULL;
+  return head;
+}
+
+inline void RegisterBindingStats(BindingStats* stats) {
+  stats->registered = true;
+  stats->next = BindingStatsList();
+  BindingStatsList() = stats;
+}
+
+inline uint64_t ReadCycleCounter() {
+#if defined(__i386__) || defined(__x86_64__)
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+#else
+  return 0;
+#endif
+}
+
+class BindingTimer {
+ public:
+  explicit BindingTimer(BindingStats* stats) : stats_(stats), start_(ReadCycleCounter()) { }
+  ~BindingTimer() { stats_->cycles += ReadCycleCounter() - start_; }
+
+ private:
+  BindingStats* stats_;
+  uint64_t start_;
+};
+
+}
+
+#if defined(KHARON_INSTRUMENT_TIMING)
+#define BINDING_TIMER util::BindingTimer binding_timer(&binding_stats)
+#else
+#define BINDING_TIMER
+#endif
+
+#if defined(KHARON_INSTRUMENT)
+#define BINDING_STATS(Name)                                                   \
+  static util::BindingStats binding_stats = { #Name, 0, 0, false, NULL };    \
+  if (!binding_stats.registered) util::RegisterBindingStats(&binding_stats); \
+  binding_stats.calls++;                                                    \
+  BINDING_TIMER
+#else
+#define BINDING_STATS(Name)
+#endif
+
+#endif
@@ -15,6 +15,14 @@
 #ifndef BINDINGS_HELPERS_H
 #define BINDINGS_HELPERS_H
 
+#include "llvm/BasicBlock.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalAlias.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instruction.h"
+#include "llvm/Module.h"
+#include "llvm/Support/ValueHandle.h"
+
 #define THROW_ERROR(str) (v8::ThrowException(v8::Exception::Error(v8::String::New(str))))
 
 #define BOOL_TO_V8(val) v8::Boolean::New((val))
@@ -75,7 +83,19 @@ inline v8::Handle<v8::String> STDStringToV8(const std::string& str) {
 
 #define VOID_TO_V8(val) ((val), v8::Undefined())
 
-#define IS_ARRAYREF(val) ((val)->IsArray())
+#define IS_ARRAYREF(val, W) IsArrayRef((val), (W))
+
+// Elements are unwrapped without checks so all of them are tested upfront.
+template<typename T>
+inline bool IsArrayRef(v8::Handle<v8::Value> val, WrapperTypedBase<T>& w) {
+  if (!val->IsArray()) return false;
+  v8::HandleScope scope;
+  v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(val);
+  for (uint32_t i = 0, len = arr->Length(); i < len; i++) {
+    if (!w.Is(arr->Get(i))) return false;
+  }
+  return true;
+}
 
 template<typename T>
 inline std::vector<T*> ArrayRefFromV8(v8::Handle<v8::Value> val, WrapperTypedBase<T>& w) {
@@ -107,24 +127,280 @@ inline std::vector<T> ArrayRefFromV8(v8::Handle<v8::Value> val) {
   return v;
 }
 
+// Address of the list containing an element or NULL if it is not in a list.
+// Used to check that a cursor of IPListView still points into its list.
+inline const void* ContainingList(const llvm::Instruction* I) {
+  return I->getParent() != NULL ? &I->getParent()->getInstList() : NULL;
+}
+
+inline const void* ContainingList(const llvm::BasicBlock* BB) {
+  return BB->getParent() != NULL ? &BB->getParent()->getBasicBlockList() : NULL;
+}
+
+inline const void* ContainingList(const llvm::Argument* A) {
+  return A->getParent() != NULL ? &A->getParent()->getArgumentList() : NULL;
+}
+
+inline const void* ContainingList(const llvm::Function* F) {
+  return F->getParent() != NULL ? &F->getParent()->getFunctionList() : NULL;
+}
+
+inline const void* ContainingList(const llvm::GlobalVariable* G) {
+  return G->getParent() != NULL ? &G->getParent()->getGlobalList() : NULL;
+}
+
+inline const void* ContainingList(const llvm::GlobalAlias* GA) {
+  return GA->getParent() != NULL ? &GA->getParent()->getAliasList() : NULL;
+}
+
+inline const void* ContainingList(const void*) { return NULL; }
+
+// Elements that are Values can be tracked by value handles, others can't.
+inline llvm::Value* TrackableValue(llvm::Value* V) { return V; }
+inline llvm::Value* TrackableValue(void*) { return NULL; }
+
+// Lazy view over an llvm::iplist exposed to JS instead of an array. Elements
+// are wrapped on demand. The view keeps cursors at the last accessed elements
+// so that sequential access (begin/next, increasing indices, forEach) does not
+// walk the list from the start. begin/next have a cursor of their own: random
+// access inside a begin/next loop does not move it.
+//
+// IR can change between accesses, so a cursor is revalidated before it is
+// used: value handles on the element under it and its predecessor detect
+// that either was erased, moved or had something inserted between them, and
+// the cursor then restarts from the beginning of the list. Insertions and
+// removals further before the cursor are not detected and shift indices
+// (see README). Elements that are not Values (named metadata) are not
+// tracked and every access walks from the start.
+//
+// The view refers to the list inside its owner (a Module, Function or
+// BasicBlock) and does not keep the owner alive: it must not be used after
+// the owner is erased.
+class IPListView {
+ public:
+  enum Cursor { kRandomAccess, kIteration, kCursorCount };
+
+  virtual ~IPListView() { }
+
+  // Number of elements in the list. Walks the whole list.
+  virtual uint32_t Size() = 0;
+
+  // Wrap element with the given index, moving the given cursor to it.
+  // Returns empty handle if it is out of bounds.
+  virtual v8::Handle<v8::Value> At(uint32_t index, Cursor cursor = kRandomAccess) = 0;
+
+  // Wrap element following the one under the iteration cursor and move the
+  // cursor to it.
+  virtual v8::Handle<v8::Value> Next() = 0;
+
+  static v8::Handle<v8::Object> Wrap(IPListView* view) {
+    v8::HandleScope scope;
+    v8::Handle<v8::Object> obj = Constructor()->NewInstance();
+    obj->SetPointerInInternalField(0, view);
+    v8::Persistent<v8::Object> weak = v8::Persistent<v8::Object>::New(obj);
+    weak.MakeWeak(view, &Dtor);
+    weak.MarkIndependent();
+    return scope.Close(obj);
+  }
+
+ private:
+  static IPListView* Unwrap(v8::Handle<v8::Object> obj) {
+    return static_cast<IPListView*>(obj->GetPointerFromInternalField(0));
+  }
+
+  static v8::Handle<v8::Value> OrNull(v8::Handle<v8::Value> elem) {
+    return elem.IsEmpty() ? v8::Handle<v8::Value>(v8::Null()) : elem;
+  }
+
+  static void Dtor(v8::Persistent<v8::Value> obj, void* ptr) {
+    obj.Dispose();
+    obj.Clear();
+    delete static_cast<IPListView*>(ptr);
+  }
+
+  static v8::Handle<v8::Value> SizeCallback(const v8::Arguments& args) {
+    return v8::Integer::NewFromUnsigned(Unwrap(args.This())->Size());
+  }
+
+  static v8::Handle<v8::Value> AtCallback(const v8::Arguments& args) {
+    if (args.Length() != 1 || !args[0]->IsUint32()) return THROW_ERROR("illegal argument #0: index expected");
+    return OrNull(Unwrap(args.This())->At(args[0]->Uint32Value()));
+  }
+
+  static v8::Handle<v8::Value> BeginCallback(const v8::Arguments& args) {
+    return OrNull(Unwrap(args.This())->At(0, kIteration));
+  }
+
+  static v8::Handle<v8::Value> NextCallback(const v8::Arguments& args) {
+    return OrNull(Unwrap(args.This())->Next());
+  }
+
+  static v8::Handle<v8::Value> ForEachCallback(const v8::Arguments& args) {
+    if (args.Length() != 1 || !args[0]->IsFunction()) return THROW_ERROR("illegal argument #0: function expected");
+    v8::HandleScope scope;
+    v8::Handle<v8::Function> fn = v8::Handle<v8::Function>::Cast(args[0]);
+    IPListView* view = Unwrap(args.This());
+    for (uint32_t i = 0; ; i++) {
+      v8::HandleScope iteration;
+      v8::Handle<v8::Value> elem = view->At(i);
+      if (elem.IsEmpty()) break;
+      v8::Handle<v8::Value> argv[] = { elem, v8::Integer::NewFromUnsigned(i) };
+      if (fn->Call(args.This(), 2, argv).IsEmpty()) return v8::Handle<v8::Value>();
+    }
+    return v8::Undefined();
+  }
+
+  static v8::Handle<v8::Value> ToArrayCallback(const v8::Arguments& args) {
+    v8::HandleScope scope;
+    IPListView* view = Unwrap(args.This());
+    v8::Handle<v8::Array> arr = v8::Array::New();
+    for (uint32_t i = 0; ; i++) {
+      v8::Handle<v8::Value> elem = view->At(i);
+      if (elem.IsEmpty()) break;
+      arr->Set(i, elem);
+    }
+    return scope.Close(arr);
+  }
+
+  static v8::Handle<v8::Value> IndexedGetter(uint32_t index, const v8::AccessorInfo& info) {
+    return Unwrap(info.This())->At(index);
+  }
+
+  static v8::Handle<v8::Value> LengthGetter(v8::Local<v8::String> property,
+                                            const v8::AccessorInfo& info) {
+    return v8::Integer::NewFromUnsigned(Unwrap(info.This())->Size());
+  }
+
+  static v8::Handle<v8::Function> Constructor() {
+    static v8::Persistent<v8::Function> ctor;
+    if (ctor.IsEmpty()) {
+      v8::Handle<v8::FunctionTemplate> templ = v8::FunctionTemplate::New();
+      templ->SetClassName(v8::String::NewSymbol("IPList"));
+
+      v8::Handle<v8::ObjectTemplate> instance = templ->InstanceTemplate();
+      instance->SetInternalFieldCount(1);
+      instance->SetIndexedPropertyHandler(&IndexedGetter);
+      instance->SetAccessor(v8::String::NewSymbol("length"), &LengthGetter);
+
+      v8::Handle<v8::Signature> sig = v8::Signature::New(templ);
+      v8::Handle<v8::ObjectTemplate> proto = templ->PrototypeTemplate();
+      proto->Set(v8::String::NewSymbol("size"), v8::FunctionTemplate::New(&SizeCallback, v8::Handle<v8::Value>(), sig));
+      proto->Set(v8::String::NewSymbol("at"), v8::FunctionTemplate::New(&AtCallback, v8::Handle<v8::Value>(), sig));
+      proto->Set(v8::String::NewSymbol("begin"), v8::FunctionTemplate::New(&BeginCallback, v8::Handle<v8::Value>(), sig));
+      proto->Set(v8::String::NewSymbol("next"), v8::FunctionTemplate::New(&NextCallback, v8::Handle<v8::Value>(), sig));
+      proto->Set(v8::String::NewSymbol("forEach"), v8::FunctionTemplate::New(&ForEachCallback, v8::Handle<v8::Value>(), sig));
+      proto->Set(v8::String::NewSymbol("toArray"), v8::FunctionTemplate::New(&ToArrayCallback, v8::Handle<v8::Value>(), sig));
+
+      ctor = v8::Persistent<v8::Function>::New(templ->GetFunction());
+    }
+    return ctor;
+  }
+};
+
 template<typename NativeT, typename WrapperT>
-inline v8::Handle<v8::Array> IPListToV8(llvm::iplist<NativeT>& list,
-                                        WrapperTypedBase<WrapperT>& w) {
-  v8::HandleScope scope;
-  uint32_t size = list.size();
-  uint32_t index = 0;
-  v8::Handle<v8::Array> arr = v8::Array::New(size);
-  for (typename llvm::iplist<NativeT>::iterator i = list.begin(); index < size; ++i, ++index) {
-    arr->Set(index, w.Wrap(i));
+class TypedIPListView : public IPListView {
+ public:
+  TypedIPListView(llvm::iplist<NativeT>& list, WrapperTypedBase<WrapperT>& w)
+      : list_(list), w_(w) {
+    for (int i = 0; i < kCursorCount; i++) Reset(cursors_[i]);
+  }
+
+  virtual uint32_t Size() {
+    return list_.size();
+  }
+
+  virtual v8::Handle<v8::Value> At(uint32_t index, Cursor which = kRandomAccess) {
+    CursorState& cursor = cursors_[which];
+    if (index < cursor.position || !IsValid(cursor)) Reset(cursor);
+    while (cursor.position < index && cursor.it != list_.end()) {
+      cursor.prev = TrackableValue(&*cursor.it);
+      ++cursor.it;
+      ++cursor.position;
+    }
+    if (cursor.it == list_.end()) {
+      cursor.node = NULL;
+      return v8::Handle<v8::Value>();
+    }
+    cursor.node = TrackableValue(&*cursor.it);
+    return w_.Wrap(&*cursor.it);
+  }
+
+  // Follows the element under the cursor while it is still in the list even
+  // if something was inserted or removed before it. Otherwise continues by
+  // index.
+  virtual v8::Handle<v8::Value> Next() {
+    CursorState& cursor = cursors_[kIteration];
+    llvm::Value* node = cursor.node;
+    if (node == NULL || ContainingList(&*cursor.it) != &list_) {
+      return At(cursor.position + 1, kIteration);
+    }
+    cursor.prev = node;
+    ++cursor.it;
+    ++cursor.position;
+    if (cursor.it == list_.end()) {
+      cursor.node = NULL;
+      return v8::Handle<v8::Value>();
+    }
+    cursor.node = TrackableValue(&*cursor.it);
+    return w_.Wrap(&*cursor.it);
   }
-  return scope.Close(arr);
+
+ private:
+  typedef typename llvm::iplist<NativeT>::iterator Iterator;
+
+  struct CursorState {
+    Iterator it;
+    uint32_t position;
+    // Element under the cursor and the one before it. Handles become NULL
+    // when the element is deleted, so the iterator is never dereferenced
+    // after that.
+    llvm::WeakVH node;
+    llvm::WeakVH prev;
+  };
+
+  void Reset(CursorState& cursor) {
+    cursor.it = list_.begin();
+    cursor.position = 0;
+    cursor.node = NULL;
+    cursor.prev = NULL;
+  }
+
+  // Resetting a cursor at the first element costs nothing, so such cursors
+  // are never considered valid.
+  bool IsValid(CursorState& cursor) {
+    if (cursor.position == 0) return false;
+    llvm::Value* node = cursor.node;
+    llvm::Value* prev = cursor.prev;
+    if (node == NULL || prev == NULL) return false;
+
+    NativeT* elem = &*cursor.it;
+    if (ContainingList(elem) != &list_ || cursor.it == list_.begin()) return false;
+    Iterator before = cursor.it;
+    --before;
+    return TrackableValue(&*before) == prev;
+  }
+
+  llvm::iplist<NativeT>& list_;
+  WrapperTypedBase<WrapperT>& w_;
+  CursorState cursors_[kCursorCount];
+};
+
+template<typename NativeT, typename WrapperT>
+inline v8::Handle<v8::Object> IPListToV8(llvm::iplist<NativeT>& list,
+                                         WrapperTypedBase<WrapperT>& w) {
+  return IPListView::Wrap(new TypedIPListView<NativeT, WrapperT>(list, w));
 }
 
 #define IPLIST_TO_V8(Wrapper, WrapperT, NativeT, val) \
   IPListToV8<NativeT, WrapperT>((val), (Wrapper))
 
+// Signature makes V8 throw if the receiver was not created from W's template
+// (or a template inheriting from it) so that Func can unwrap it unchecked.
 #define BIND_INSTANCE_METHOD(W, Name, Func)                             \
-  (W).Prototype()->Set(v8::String::New(#Name), v8::FunctionTemplate::New(&Func))
+  (W).Prototype()->Set(v8::String::New(#Name),                          \
+                       v8::FunctionTemplate::New(&Func,                 \
+                                                 v8::Handle<v8::Value>(), \
+                                                 v8::Signature::New((W).Template())))
 
 #define BIND_STATIC_METHOD(W, Name, Func)                             \
   (W).Template()->Set(v8::String::New(#Name), v8::FunctionTemplate::New(&Func))
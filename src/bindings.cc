@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <node.h>
+#include <node_buffer.h>
 
 #include "llvm/DerivedTypes.h"
 #include "llvm/LLVMContext.h"
@@ -21,16 +22,42 @@
 #include "llvm/IRBuilder.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/PassManager.h"
 #include "llvm/InlineAsm.h"
 #include "llvm/Intrinsics.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unistd.h>
+#ifdef __ELF__
+#include <link.h>
+#endif
 
 #include "wrappers.h"
 #include "bindings-helpers.h"
+#include "lazy-compilation.h"
+#include "memory-stats.h"
+#include "code-pool.h"
+#include "edge-profiler.h"
+#include "binding-stats.h"
+#include "function-dedup.h"
+#include "parallel-for.h"
 
 inline void* MakeIRBuilder(const v8::Arguments& args) {
   return new llvm::IRBuilder<> (llvm::getGlobalContext());
@@ -45,6 +72,12 @@ inline void* MakeModule(const v8::Arguments& args) {
   return new llvm::Module(*name, llvm::getGlobalContext());
 }
 
+// Modules and pass managers own symbol tables, pass instances and analysis
+// results in addition to the object itself. IR added to modules is reported
+// separately by util::EngineMemory.
+template<> struct ExternalSize<llvm::Module> { static const int value = 16 * 1024; };
+template<> struct ExternalSize<llvm::FunctionPassManager> { static const int value = 8 * 1024; };
+
 Wrapper<llvm::IRBuilderBase> IRBuilderBase;
 Wrapper<llvm::IRBuilder<>, &MakeIRBuilder> IRBuilder(IRBuilderBase);
 Wrapper<llvm::Module, &MakeModule> Module;
@@ -53,6 +86,7 @@ Wrapper<llvm::Type> Type;
 Wrapper<llvm::FunctionType> FunctionType(Type);
 Wrapper<llvm::ArrayType> ArrayType(Type);
 Wrapper<llvm::StructType> StructType(Type);
+Wrapper<llvm::VectorType> VectorType(Type);
 Wrapper<llvm::Value> Value;
 Wrapper<llvm::GlobalValue> GlobalValue(Value);
 Wrapper<llvm::Function> Function(GlobalValue);
@@ -65,6 +99,49 @@ Wrapper<llvm::PHINode> PHINode(Value);
 Wrapper<llvm::Constant> Constant(Value);
 Wrapper<llvm::ConstantInt> ConstantInt(Constant);
 Wrapper<llvm::ConstantFP> ConstantFP(Constant);
+Wrapper<llvm::ConstantVector> ConstantVector(Constant);
+Wrapper<llvm::UndefValue> UndefValue(Constant);
+
+// Optional argument is an object with arenaSize (bytes, 2MB by default) and
+// hugePages (false by default) properties.
+inline void* MakeCodePool(const v8::Arguments& args) {
+  if (args.Length() > 1 || (args.Length() == 1 && !args[0]->IsObject())) {
+    THROW_ERROR("expected optional options object");
+    return NULL;
+  }
+
+  size_t arena_size = util::CodePool::kHugePageSize;
+  bool huge_pages = false;
+  if (args.Length() == 1) {
+    v8::Handle<v8::Object> opts = args[0]->ToObject();
+    v8::Handle<v8::Value> size = opts->Get(v8::String::New("arenaSize"));
+    if (size->IsUint32() && size->Uint32Value() > 0) arena_size = size->Uint32Value();
+    huge_pages = BOOL_FROM_V8(opts->Get(v8::String::New("hugePages")));
+  }
+  return new util::CodePool(arena_size, huge_pages);
+}
+
+
+// Pools are shared with memory managers of engines and are never deleted.
+Wrapper<util::CodePool, &MakeCodePool> CodePool;
+
+
+namespace util {
+// Engine settings that have no counterpart in llvm::EngineBuilder. They are
+// applied to the ExecutionEngine by EngineBuilder_create.
+struct EngineBuilderExtras {
+  EngineBuilderExtras()
+      : lazy(false), kind(llvm::EngineKind::JIT | llvm::EngineKind::Interpreter),
+        code_pool(NULL) { }
+
+  bool lazy;
+  int kind;
+  CodePool* code_pool;
+};
+
+std::map<llvm::EngineBuilder*, EngineBuilderExtras> engine_builder_extras;
+}
+
 
 inline void* MakeEngineBuilder(const v8::Arguments& args) {
   if (args.Length() != 1 || !Module.Is(args[0])) {
@@ -94,6 +171,12 @@ inline void* MakeFunctionPassManager(const v8::Arguments& args) {
 
 
 Wrapper<llvm::FunctionPassManager, &MakeFunctionPassManager> FunctionPassManager;
+
+inline void* MakePassManager(const v8::Arguments& args) {
+  return new llvm::PassManager();
+}
+
+Wrapper<llvm::PassManager, &MakePassManager> PassManager;
 Wrapper<llvm::Pass> Pass;
 
 void* MakeTargetData(const v8::Arguments& args);
@@ -110,13 +193,543 @@ void* MakeTargetData(const v8::Arguments& args) {
 }
 
 
+// Arguments are optional: target triple, CPU name and feature string. They
+// default to the host so that emitted code matches what the JIT would produce.
+inline void* MakeTargetMachine(const v8::Arguments& args) {
+  for (int i = 0; i < args.Length(); i++) {
+    if (!args[i]->IsString()) {
+      THROW_ERROR("expected up to 3 string arguments: triple, cpu, features");
+      return NULL;
+    }
+  }
+
+  std::string triple = args.Length() > 0 ? STDSTRING_FROM_V8(args[0]) : llvm::sys::getDefaultTargetTriple();
+  std::string cpu = args.Length() > 1 ? STDSTRING_FROM_V8(args[1]) : llvm::sys::getHostCPUName();
+  std::string features = args.Length() > 2 ? STDSTRING_FROM_V8(args[2]) : "";
+
+  std::string errstr;
+  const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, errstr);
+  if (target == NULL) {
+    THROW_ERROR(errstr.c_str());
+    return NULL;
+  }
+
+  // Emitted objects are meant to be linked into shared libraries.
+  llvm::TargetMachine* tm = target->createTargetMachine(
+      triple, cpu, features, llvm::TargetOptions(), llvm::Reloc::PIC_);
+  if (tm == NULL) {
+    THROW_ERROR("failed to create target machine");
+    return NULL;
+  }
+  return tm;
+}
+
+
+Wrapper<llvm::TargetMachine, &MakeTargetMachine> TargetMachine;
+
+namespace util {
+// Runs code generation for the whole module and collects the result in |out|.
+// Returns false if the target can't produce files of the given type.
+// Codegen passes rewrite IR (e.g. lower intrinsics) so they run on a copy:
+// M may belong to a live ExecutionEngine.
+bool EmitModule(llvm::TargetMachine* tm,
+                llvm::Module* M,
+                llvm::TargetMachine::CodeGenFileType type,
+                std::string* out) {
+  llvm::Module* clone = llvm::CloneModule(M);
+  bool emitted = false;
+  {
+    llvm::raw_string_ostream os(*out);
+    llvm::formatted_raw_ostream fos(os);
+
+    llvm::PassManager pm;
+    pm.add(new llvm::TargetData(*tm->getTargetData()));
+    if (!tm->addPassesToEmitFile(pm, fos, type)) {
+      pm.run(*clone);
+      emitted = true;
+    }
+  }
+  delete clone;
+  return emitted;
+}
+}
+
+
+static bool FileTypeFromV8(v8::Handle<v8::Value> value, llvm::TargetMachine::CodeGenFileType* type) {
+  if (value->IsUndefined()) {
+    *type = llvm::TargetMachine::CGFT_ObjectFile;
+    return true;
+  }
+
+  if (!value->IsString()) return false;
+  std::string kind = STDSTRING_FROM_V8(value);
+  if (kind == "obj") {
+    *type = llvm::TargetMachine::CGFT_ObjectFile;
+  } else if (kind == "asm") {
+    *type = llvm::TargetMachine::CGFT_AssemblyFile;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+// emitToBuffer(module[, "obj" | "asm"]) returns a Buffer with the object file
+// or assembly listing of the module.
+static v8::Handle<v8::Value> TargetMachine_emitToBuffer(const v8::Arguments& args) {
+  if (args.Length() < 1 || !Module.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Module expected");
+  llvm::TargetMachine::CodeGenFileType type;
+  if (!FileTypeFromV8(args[1], &type)) return THROW_ERROR("illegal argument #1: 'obj' or 'asm' expected");
+
+  std::string out;
+  if (!util::EmitModule(TargetMachine.Unwrap(args.This()), Module.Unwrap(args[0]), type, &out)) {
+    return THROW_ERROR("target does not support emission of this file type");
+  }
+  return node::Buffer::New(out.data(), out.size())->handle_;
+}
+
+
+// emitToFile(module, path[, "obj" | "asm"]) writes the object file or
+// assembly listing of the module to the given path.
+static v8::Handle<v8::Value> TargetMachine_emitToFile(const v8::Arguments& args) {
+  if (args.Length() < 1 || !Module.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Module expected");
+  if (args.Length() < 2 || !args[1]->IsString()) return THROW_ERROR("illegal argument #1: path expected");
+  llvm::TargetMachine::CodeGenFileType type;
+  if (!FileTypeFromV8(args[2], &type)) return THROW_ERROR("illegal argument #2: 'obj' or 'asm' expected");
+
+  std::string out;
+  if (!util::EmitModule(TargetMachine.Unwrap(args.This()), Module.Unwrap(args[0]), type, &out)) {
+    return THROW_ERROR("target does not support emission of this file type");
+  }
+
+  std::string errstr;
+  llvm::raw_fd_ostream file(*v8::String::Utf8Value(args[1]), errstr, llvm::raw_fd_ostream::F_Binary);
+  if (!errstr.empty()) return THROW_ERROR(errstr.c_str());
+  file << out;
+  return v8::Undefined();
+}
+
+
+// Kind is mirrored to decide in EngineBuilder_create whether the engine
+// can take a JIT memory manager.
+static v8::Handle<v8::Value> EngineBuilder_setEngineKind(const v8::Arguments& args) {
+  if (args.Length() != 1 || !args[0]->IsInt32()) return THROW_ERROR("illegal argument #0: llvm.EngineKind expected");
+  llvm::EngineKind::Kind kind = static_cast<llvm::EngineKind::Kind>(args[0]->Int32Value());
+  util::engine_builder_extras[EngineBuilder.Unwrap(args.This())].kind = kind;
+  EngineBuilder.Unwrap(args.This())->setEngineKind(kind);
+  return args.This();
+}
+
+
+static v8::Handle<v8::Value> EngineBuilder_setLazyCompilation(const v8::Arguments& args) {
+  if (args.Length() != 1 || !IS_BOOL(args[0])) return THROW_ERROR("illegal argument #0: boolean expected");
+  util::engine_builder_extras[EngineBuilder.Unwrap(args.This())].lazy = BOOL_FROM_V8(args[0]);
+  return args.This();
+}
+
+
+// Makes the JIT take memory for code and stubs from the given pool instead
+// of the default memory manager.
+static v8::Handle<v8::Value> EngineBuilder_setCodePool(const v8::Arguments& args) {
+  if (args.Length() != 1 || !CodePool.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.CodePool expected");
+  util::engine_builder_extras[EngineBuilder.Unwrap(args.This())].code_pool = CodePool.Unwrap(args[0]);
+  return args.This();
+}
+
+
+static v8::Handle<v8::Value> EngineBuilder_setTargetOptions(const v8::Arguments& args) {
+  if (args.Length() != 1 || !args[0]->IsObject()) return THROW_ERROR("illegal argument #0: options object expected");
+  v8::Handle<v8::Object> opts = args[0]->ToObject();
+
+  // Only options that make sense for JIT'd code are exposed. The old JIT
+  // ignores JITEmitDebugInfo, use GDBJITEventListener to make JIT'd code
+  // visible to GDB.
+  llvm::TargetOptions options;
+  options.NoFramePointerElim = BOOL_FROM_V8(opts->Get(v8::String::New("NoFramePointerElim")));
+  options.UnsafeFPMath = BOOL_FROM_V8(opts->Get(v8::String::New("UnsafeFPMath")));
+
+  EngineBuilder.Unwrap(args.This())->setTargetOptions(options);
+  return args.This();
+}
+
+
 static v8::Handle<v8::Value> EngineBuilder_create (const v8::Arguments& args) {
   if (args.Length() != 0) return THROW_ERROR("illegal number of arguments");
   std::string errstr;
-  llvm::ExecutionEngine* ee = EngineBuilder.Unwrap(args.This())->setErrorStr(&errstr).create();
-  return ee != NULL ? ExecutionEngine.Wrap(ee) : THROW_ERROR(errstr.c_str());
+  llvm::EngineBuilder* builder = EngineBuilder.Unwrap(args.This());
+  util::EngineBuilderExtras& extras = util::engine_builder_extras[builder];
+
+  // Memory manager is created explicitly to be able to query its statistics.
+  // Giving one to the builder rules out the interpreter, so unless a code
+  // pool was requested it is only set when the JIT was asked for explicitly
+  // and the default kind keeps falling back to the interpreter.
+  llvm::JITMemoryManager* memory_manager = NULL;
+  if (extras.code_pool != NULL) {
+    memory_manager = new util::PooledJITMemoryManager(extras.code_pool);
+  } else if (extras.kind == llvm::EngineKind::JIT) {
+    memory_manager = llvm::JITMemoryManager::CreateDefaultMemManager();
+  }
+  llvm::ExecutionEngine* ee =
+      builder->setErrorStr(&errstr).setJITMemoryManager(memory_manager).create();
+  if (ee == NULL) {
+    delete memory_manager;
+    return THROW_ERROR(errstr.c_str());
+  }
+
+  ee->DisableLazyCompilation(!extras.lazy);
+  util::CodePool* code_pool = memory_manager != NULL ? extras.code_pool : NULL;
+  // The module itself is accounted for by its wrapper (ExternalSize<Module>).
+  util::EngineMemory::Register(ee, memory_manager, code_pool);
+  return ExecutionEngine.Wrap(ee);
+}
+
+
+static v8::Handle<v8::Value> ExecutionEngine_addModule(const v8::Arguments& args) {
+  if (args.Length() != 1 || !Module.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Module expected");
+  llvm::ExecutionEngine* ee = ExecutionEngine.Unwrap(args.This());
+  llvm::Module* M = Module.Unwrap(args[0]);
+  ee->addModule(M);
+  util::EngineMemory* memory = util::EngineMemory::For(ee);
+  if (memory != NULL) memory->AddModule(M);
+  return v8::Undefined();
+}
+
+
+// getMemoryStats() returns native memory usage in bytes. engines lists every
+// ExecutionEngine: estimated size of IR (ir), emitted machine code (code) and
+// memory reserved for code, JIT stubs and globals (codeReserved,
+// stubsReserved, dataReserved). Code and stubs of engines using a CodePool
+// are reported by codePools[codePool] instead: bytes allocated to functions
+// and stubs (code), mapped arenas (codeReserved, stubsReserved) and free bytes.
+static v8::Handle<v8::Value> LLVM_getMemoryStats(const v8::Arguments& args) {
+  if (args.Length() != 0) return THROW_ERROR("illegal number of arguments");
+  v8::HandleScope scope;
+
+  std::vector<util::EngineMemory*>& engines = util::EngineMemory::engines();
+  std::vector<util::CodePool*> pools;
+  v8::Local<v8::Array> engine_stats = v8::Array::New(engines.size());
+  for (size_t i = 0; i < engines.size(); i++) {
+    util::EngineMemory* memory = engines[i];
+    v8::Local<v8::Object> stats = v8::Object::New();
+    stats->Set(v8::String::NewSymbol("ir"), v8::Number::New(memory->ir_size()));
+    stats->Set(v8::String::NewSymbol("code"), v8::Number::New(memory->code_size()));
+    stats->Set(v8::String::NewSymbol("functions"), v8::Number::New(memory->function_count()));
+    stats->Set(v8::String::NewSymbol("codeReserved"), v8::Number::New(memory->code_reserved()));
+    stats->Set(v8::String::NewSymbol("stubsReserved"), v8::Number::New(memory->stub_reserved()));
+    stats->Set(v8::String::NewSymbol("dataReserved"), v8::Number::New(memory->data_reserved()));
+
+    // Pools can be shared by engines so each one is reported once and
+    // engines refer to it by index.
+    util::CodePool* pool = memory->code_pool();
+    if (pool != NULL) {
+      size_t index = std::find(pools.begin(), pools.end(), pool) - pools.begin();
+      if (index == pools.size()) pools.push_back(pool);
+      stats->Set(v8::String::NewSymbol("codePool"), v8::Number::New(index));
+    }
+    engine_stats->Set(i, stats);
+  }
+
+  v8::Local<v8::Array> pool_stats = v8::Array::New(pools.size());
+  for (size_t i = 0; i < pools.size(); i++) {
+    util::CodePool* pool = pools[i];
+    v8::Local<v8::Object> stats = v8::Object::New();
+    stats->Set(v8::String::NewSymbol("code"), v8::Number::New(pool->usedBytes()));
+    stats->Set(v8::String::NewSymbol("functions"), v8::Number::New(pool->functionCount()));
+    stats->Set(v8::String::NewSymbol("codeReserved"), v8::Number::New(pool->codeReservedBytes()));
+    stats->Set(v8::String::NewSymbol("stubsReserved"), v8::Number::New(pool->stubReservedBytes()));
+    stats->Set(v8::String::NewSymbol("free"), v8::Number::New(pool->freeBytes()));
+    pool_stats->Set(i, stats);
+  }
+
+  v8::Local<v8::Object> result = v8::Object::New();
+  result->Set(v8::String::NewSymbol("engines"), engine_stats);
+  result->Set(v8::String::NewSymbol("codePools"), pool_stats);
+  return scope.Close(result);
+}
+
+
+// getBindingStats() returns an array with the number of calls (and cycles
+// spent when timing is enabled) of every generated binding called so far.
+// It is empty unless bindings were generated with kharon --instrument.
+static v8::Handle<v8::Value> LLVM_getBindingStats(const v8::Arguments& args) {
+  if (args.Length() != 0) return THROW_ERROR("illegal number of arguments");
+  v8::HandleScope scope;
+
+  v8::Local<v8::Array> result = v8::Array::New();
+  uint32_t idx = 0;
+  for (util::BindingStats* stats = util::BindingStatsList(); stats != NULL; stats = stats->next) {
+    v8::Local<v8::Object> entry = v8::Object::New();
+    entry->Set(v8::String::NewSymbol("name"), v8::String::New(stats->name));
+    entry->Set(v8::String::NewSymbol("calls"), v8::Number::New(static_cast<double>(stats->calls)));
+    entry->Set(v8::String::NewSymbol("cycles"), v8::Number::New(static_cast<double>(stats->cycles)));
+    result->Set(idx++, entry);
+  }
+  return scope.Close(result);
+}
+
+
+static v8::Handle<v8::Value> LLVM_resetBindingStats(const v8::Arguments& args) {
+  if (args.Length() != 0) return THROW_ERROR("illegal number of arguments");
+  for (util::BindingStats* stats = util::BindingStatsList(); stats != NULL; stats = stats->next) {
+    stats->calls = stats->cycles = 0;
+  }
+  return v8::Undefined();
+}
+
+
+inline void* MakeEdgeProfiler(const v8::Arguments& args) {
+  return new util::EdgeProfiler();
+}
+
+Wrapper<util::EdgeProfiler, &MakeEdgeProfiler> EdgeProfiler;
+
+// Returns array of [taken, not taken] counts for every conditional branch of
+// an instrumented function or null.
+static v8::Handle<v8::Value> EdgeProfiler_countersOf(const v8::Arguments& args) {
+  if (args.Length() != 1 || !Function.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Function expected");
+  const std::vector<uint64_t>* counters = EdgeProfiler.Unwrap(args.This())->countersOf(Function.Unwrap(args[0]));
+  if (counters == NULL) return v8::Null();
+
+  v8::HandleScope scope;
+  v8::Local<v8::Array> result = v8::Array::New(counters->size() / 2);
+  for (size_t i = 0; i < counters->size() / 2; i++) {
+    v8::Local<v8::Array> edge = v8::Array::New(2);
+    edge->Set(0, v8::Number::New(static_cast<double>((*counters)[2 * i])));
+    edge->Set(1, v8::Number::New(static_cast<double>((*counters)[2 * i + 1])));
+    result->Set(i, edge);
+  }
+  return scope.Close(result);
+}
+
+
+Wrapper<llvm::JITEventListener> JITEventListener;
+
+namespace util {
+// Appends an entry for every JIT'd function to /tmp/perf-<pid>.map which is
+// where perf looks for symbols of code that does not belong to any DSO.
+class PerfMapJITEventListener : public llvm::JITEventListener {
+ public:
+  PerfMapJITEventListener() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+    file_ = fopen(path, "a");
+  }
+
+  virtual ~PerfMapJITEventListener() {
+    if (file_ != NULL) fclose(file_);
+  }
+
+  virtual void NotifyFunctionEmitted(const llvm::Function& F,
+                                     void* Code,
+                                     size_t Size,
+                                     const EmittedFunctionDetails& Details) {
+    if (file_ == NULL) return;
+    fprintf(file_, "%lx %lx %s\n",
+            reinterpret_cast<unsigned long>(Code),
+            static_cast<unsigned long>(Size),
+            F.getName().str().c_str());
+    fflush(file_);
+  }
+
+ private:
+  FILE* file_;
+};
+}
+
+inline void* MakePerfMapJITEventListener(const v8::Arguments& args) {
+  return new util::PerfMapJITEventListener();
+}
+
+Wrapper<util::PerfMapJITEventListener, &MakePerfMapJITEventListener> PerfMapJITEventListener(JITEventListener);
+
+
+// GDB's JIT compilation interface: GDB breaks in __jit_debug_register_code
+// and reads the in-memory symbol file of relevant_entry. Definitions are
+// weak because LLVM's MCJIT provides the same ones.
+extern "C" {
+struct jit_code_entry {
+  jit_code_entry* next_entry;
+  jit_code_entry* prev_entry;
+  const char* symfile_addr;
+  uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+  uint32_t version;
+  uint32_t action_flag;
+  jit_code_entry* relevant_entry;
+  jit_code_entry* first_entry;
+};
+
+__attribute__((weak, noinline)) void __jit_debug_register_code() {
+  __asm__ __volatile__("");
+}
+
+__attribute__((weak)) jit_descriptor __jit_debug_descriptor = { 1, 0, NULL, NULL };
+}
+
+namespace util {
+// Registers every JIT'd function with GDB through its JIT interface as a
+// tiny ELF object holding a single symbol for the function's code, so that
+// backtraces show function names. No line tables are emitted. Does nothing
+// on platforms that do not use ELF.
+class GDBJITEventListener : public llvm::JITEventListener {
+ public:
+  virtual ~GDBJITEventListener() {
+    while (!entries_.empty()) Unregister(entries_.begin());
+  }
+
+  virtual void NotifyFunctionEmitted(const llvm::Function& F,
+                                     void* Code,
+                                     size_t Size,
+                                     const EmittedFunctionDetails& Details) {
+#ifdef __ELF__
+    NotifyFreeingMachineCode(Code);
+
+    std::string image = SymbolFile(F.getName(), Code, Size);
+    char* symfile = new char[image.size()];
+    memcpy(symfile, image.data(), image.size());
+
+    jit_code_entry* entry = new jit_code_entry;
+    entry->symfile_addr = symfile;
+    entry->symfile_size = image.size();
+    entry->prev_entry = NULL;
+    entry->next_entry = __jit_debug_descriptor.first_entry;
+    if (entry->next_entry != NULL) entry->next_entry->prev_entry = entry;
+    __jit_debug_descriptor.first_entry = entry;
+    Notify(kRegister, entry);
+    entries_[Code] = entry;
+#endif
+  }
+
+  virtual void NotifyFreeingMachineCode(void* OldPtr) {
+    std::map<void*, jit_code_entry*>::iterator it = entries_.find(OldPtr);
+    if (it != entries_.end()) Unregister(it);
+  }
+
+ private:
+  enum Action { kNoAction, kRegister, kUnregister };
+
+  static void Notify(Action action, jit_code_entry* entry) {
+    __jit_debug_descriptor.action_flag = action;
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_register_code();
+    __jit_debug_descriptor.action_flag = kNoAction;
+    __jit_debug_descriptor.relevant_entry = NULL;
+  }
+
+  void Unregister(std::map<void*, jit_code_entry*>::iterator it) {
+    jit_code_entry* entry = it->second;
+    entries_.erase(it);
+
+    if (entry->prev_entry != NULL) {
+      entry->prev_entry->next_entry = entry->next_entry;
+    } else {
+      __jit_debug_descriptor.first_entry = entry->next_entry;
+    }
+    if (entry->next_entry != NULL) entry->next_entry->prev_entry = entry->prev_entry;
+    Notify(kUnregister, entry);
+
+    delete[] entry->symfile_addr;
+    delete entry;
+  }
+
+#ifdef __ELF__
+  // Relocatable object with sections: null, .text (no bits, placed at the
+  // code), .symtab, .strtab and .shstrtab.
+  static std::string SymbolFile(llvm::StringRef name, void* code, size_t size) {
+    static const char kSectionNames[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+    enum { kText = 1, kSymtab, kStrtab, kShstrtab, kSectionCount };
+    static const size_t kSectionNameOffsets[] = { 0, 1, 7, 15, 23 };
+
+    std::string strtab = std::string(1, '\0') + name.str() + '\0';
+
+    ElfW(Ehdr) header;
+    ElfW(Shdr) sections[kSectionCount];
+    ElfW(Sym) symbols[2];
+    memset(&header, 0, sizeof(header));
+    memset(sections, 0, sizeof(sections));
+    memset(symbols, 0, sizeof(symbols));
+
+    size_t symtab_offset = sizeof(header) + sizeof(sections);
+    size_t strtab_offset = symtab_offset + sizeof(symbols);
+    size_t shstrtab_offset = strtab_offset + strtab.size();
+
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    header.e_ident[EI_DATA] = ELFDATA2MSB;
+#else
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+#endif
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_REL;
+#if defined(__x86_64__)
+    header.e_machine = EM_X86_64;
+#elif defined(__i386__)
+    header.e_machine = EM_386;
+#elif defined(__arm__)
+    header.e_machine = EM_ARM;
+#endif
+    header.e_version = EV_CURRENT;
+    header.e_shoff = sizeof(header);
+    header.e_ehsize = sizeof(header);
+    header.e_shentsize = sizeof(ElfW(Shdr));
+    header.e_shnum = kSectionCount;
+    header.e_shstrndx = kShstrtab;
+
+    for (int i = 0; i < kSectionCount; i++) sections[i].sh_name = kSectionNameOffsets[i];
+
+    sections[kText].sh_type = SHT_NOBITS;
+    sections[kText].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[kText].sh_addr = reinterpret_cast<uintptr_t>(code);
+    sections[kText].sh_size = size;
+    sections[kText].sh_addralign = 1;
+
+    sections[kSymtab].sh_type = SHT_SYMTAB;
+    sections[kSymtab].sh_offset = symtab_offset;
+    sections[kSymtab].sh_size = sizeof(symbols);
+    sections[kSymtab].sh_link = kStrtab;
+    sections[kSymtab].sh_info = 1;  // Index of the first global symbol.
+    sections[kSymtab].sh_addralign = sizeof(void*);
+    sections[kSymtab].sh_entsize = sizeof(ElfW(Sym));
+
+    sections[kStrtab].sh_type = SHT_STRTAB;
+    sections[kStrtab].sh_offset = strtab_offset;
+    sections[kStrtab].sh_size = strtab.size();
+    sections[kStrtab].sh_addralign = 1;
+
+    sections[kShstrtab].sh_type = SHT_STRTAB;
+    sections[kShstrtab].sh_offset = shstrtab_offset;
+    sections[kShstrtab].sh_size = sizeof(kSectionNames);
+    sections[kShstrtab].sh_addralign = 1;
+
+    // Value is relative to .text.
+    symbols[1].st_name = 1;
+    symbols[1].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+    symbols[1].st_shndx = kText;
+    symbols[1].st_size = size;
+
+    std::string image;
+    image.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    image.append(reinterpret_cast<const char*>(sections), sizeof(sections));
+    image.append(reinterpret_cast<const char*>(symbols), sizeof(symbols));
+    image.append(strtab);
+    image.append(kSectionNames, sizeof(kSectionNames));
+    return image;
+  }
+#endif
+
+  std::map<void*, jit_code_entry*> entries_;
+};
 }
 
+inline void* MakeGDBJITEventListener(const v8::Arguments& args) {
+  return new util::GDBJITEventListener();
+}
+
+Wrapper<util::GDBJITEventListener, &MakeGDBJITEventListener> GDBJITEventListener(JITEventListener);
+
 
 // TODO: teach it to manage function lifetime properly
 namespace util {
@@ -124,8 +737,11 @@ class FunctionPointer {
  public:
   FunctionPointer(void* ptr) : ptr_(ptr) { }
 
-  v8::Handle<v8::Function> toJSFunction() {
-    return v8::FunctionTemplate::New(reinterpret_cast<v8::InvocationCallback>(ptr_))->GetFunction();
+  void* ptr() const { return ptr_; }
+
+  // |data| is available to the function through Arguments::Data.
+  v8::Handle<v8::Function> toJSFunction(v8::Handle<v8::Value> data) {
+    return v8::FunctionTemplate::New(reinterpret_cast<v8::InvocationCallback>(ptr_), data)->GetFunction();
   }
 
  private:
@@ -137,10 +753,174 @@ Wrapper<util::FunctionPointer> FunctionPointer;
 
 static v8::Handle<v8::Value> ExecutionEngine_getPointerToFunction(const v8::Arguments& args) {
   if (args.Length() != 1 || !Function.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Function expected");
-  return FunctionPointer.Wrap(new util::FunctionPointer(ExecutionEngine.Unwrap(args.This())->getPointerToFunction(Function.Unwrap(args[0]))));
+  llvm::ExecutionEngine* ee = ExecutionEngine.Unwrap(args.This());
+  llvm::Function* F = Function.Unwrap(args[0]);
+  void* ptr = ee->getPointerToFunction(F);
+
+  util::EngineMemory* memory = util::EngineMemory::For(ee);
+  if (memory != NULL) memory->ReportFunction(F);
+  return FunctionPointer.Wrap(new util::FunctionPointer(ptr));
+}
+
+
+namespace util {
+std::map<llvm::ExecutionEngine*, FunctionDeduplicator> function_dedup;
+}
+
+
+// Like getPointerToFunction but reuses machine code of a structurally
+// identical function compiled by this engine before. Such duplicate is not
+// compiled: it is mapped to the existing code and its body is dropped.
+// The function should be optimized already since identical optimized
+// functions are much more common than identical unoptimized ones.
+static v8::Handle<v8::Value> ExecutionEngine_getPointerToCanonicalFunction(const v8::Arguments& args) {
+  if (args.Length() != 1 || !Function.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Function expected");
+  llvm::ExecutionEngine* ee = ExecutionEngine.Unwrap(args.This());
+  llvm::Function* F = Function.Unwrap(args[0]);
+
+  // Already compiled or mapped.
+  void* ptr = ee->getPointerToGlobalIfAvailable(F);
+  if (ptr != NULL) return FunctionPointer.Wrap(new util::FunctionPointer(ptr));
+
+  util::FunctionDeduplicator& dedup = util::function_dedup[ee];
+  std::string key = util::FunctionDeduplicator::KeyOf(F);
+  ptr = dedup.Find(key);
+  if (ptr != NULL) {
+    ee->addGlobalMapping(F, ptr);
+    F->deleteBody();
+    dedup.AddDuplicate(F, ptr);
+  } else {
+    ptr = ee->getPointerToFunction(F);
+    dedup.Add(key, F, ptr);
+  }
+
+  util::EngineMemory* memory = util::EngineMemory::For(ee);
+  if (memory != NULL) memory->ReportFunction(F);
+  return FunctionPointer.Wrap(new util::FunctionPointer(ptr));
+}
+
+
+// Duplicates created by getPointerToCanonicalFunction only lose their
+// mapping: the code they share is freed once neither the canonical function
+// nor any duplicate uses it.
+static v8::Handle<v8::Value> ExecutionEngine_freeMachineCodeForFunction(const v8::Arguments& args) {
+  if (args.Length() != 1 || !Function.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Function expected");
+  llvm::ExecutionEngine* ee = ExecutionEngine.Unwrap(args.This());
+  llvm::Function* F = Function.Unwrap(args[0]);
+
+  util::EngineMemory* memory = util::EngineMemory::For(ee);
+  if (memory != NULL) memory->ForgetFunction(F);
+
+  std::map<llvm::ExecutionEngine*, util::FunctionDeduplicator>::iterator it = util::function_dedup.find(ee);
+  if (it == util::function_dedup.end()) {
+    ee->freeMachineCodeForFunction(F);
+    return v8::Undefined();
+  }
+
+  util::FunctionDeduplicator& dedup = it->second;
+  if (dedup.IsDuplicate(F)) ee->updateGlobalMapping(F, NULL);
+  llvm::Function* victim = dedup.Release(F);
+  if (victim != NULL) ee->freeMachineCodeForFunction(victim);
+  return v8::Undefined();
+}
+
+
+// Returns pointer to a stub that compiles the function on the first call when
+// lazy compilation is enabled. Optional FunctionPassManager is run over
+// the function right before it is compiled.
+static v8::Handle<v8::Value> ExecutionEngine_getPointerToFunctionOrStub(const v8::Arguments& args) {
+  if (args.Length() < 1 || !Function.Is(args[0])) return THROW_ERROR("illegal argument #0: llvm.Function expected");
+  if (args.Length() > 1 && !FunctionPassManager.Is(args[1])) return THROW_ERROR("illegal argument #1: llvm.FunctionPassManager expected");
+
+  llvm::ExecutionEngine* ee = ExecutionEngine.Unwrap(args.This());
+  llvm::Function* F = Function.Unwrap(args[0]);
+
+  if (args.Length() > 1) {
+    util::LazyFunctionOptimizer::For(F->getParent())->Defer(F, FunctionPassManager.Unwrap(args[1]));
+  }
+
+  // Stubs of engines that do not compile lazily abort when called.
+  void* ptr = ee->isCompilingLazily() ? ee->getPointerToFunctionOrStub(F)
+                                      : ee->getPointerToFunction(F);
+
+  util::EngineMemory* memory = util::EngineMemory::For(ee);
+  if (memory != NULL) memory->ReportFunction(F);
+  return FunctionPointer.Wrap(new util::FunctionPointer(ptr));
 }
 
 
 static v8::Handle<v8::Value> FunctionPointer_toJSFunction(const v8::Arguments& args) {
-  return FunctionPointer.Unwrap(args.This())->toJSFunction();
+  // Optional argument is a generic fallback for JIT'd code that bails out (see v8capi_bailout).
+  if (args.Length() > 1) return THROW_ERROR("illegal number of arguments");
+  if (args.Length() == 1 && !args[0]->IsFunction() && !args[0]->IsUndefined()) {
+    return THROW_ERROR("illegal argument #0: function expected");
+  }
+  v8::Handle<v8::Value> fallback = args.Length() == 1 ? args[0] : v8::Handle<v8::Value>();
+  return FunctionPointer.Unwrap(args.This())->toJSFunction(fallback);
+}
+
+
+// parallelFor(data, begin, end[, grain], callback) runs the function, which
+// must have void(i8*, i64, i64) signature, over chunks of [begin, end) on
+// a thread pool. |data| is a typed array (or Buffer) whose backing store is
+// passed as the first argument. |callback| is called when all chunks are done.
+static v8::Handle<v8::Value> FunctionPointer_parallelFor(const v8::Arguments& args) {
+  if (args.Length() != 4 && args.Length() != 5) return THROW_ERROR("illegal number of arguments");
+  if (!args[0]->IsObject() || !args[0]->ToObject()->HasIndexedPropertiesInExternalArrayData()) {
+    return THROW_ERROR("illegal argument #0: typed array expected");
+  }
+  if (!args[1]->IsNumber()) return THROW_ERROR("illegal argument #1: number expected");
+  if (!args[2]->IsNumber()) return THROW_ERROR("illegal argument #2: number expected");
+  if (args.Length() == 5 && !args[3]->IsNumber()) return THROW_ERROR("illegal argument #3: grain size expected");
+  v8::Handle<v8::Value> callback = args[args.Length() - 1];
+  if (!callback->IsFunction()) return THROW_ERROR("last argument should be a callback");
+
+  // Kernels index the backing store without checks on other threads where
+  // a fault can't be reported, so the range is validated here.
+  v8::Handle<v8::Object> data = args[0]->ToObject();
+  int64_t length = data->GetIndexedPropertiesExternalArrayDataLength();
+  int64_t begin = args[1]->IntegerValue();
+  int64_t end = args[2]->IntegerValue();
+  int64_t grain = args.Length() == 5 ? args[3]->IntegerValue() : 0;
+  if (begin < 0) return THROW_ERROR("illegal argument #1: begin should not be negative");
+  if (end > length) return THROW_ERROR("illegal argument #2: end is past the end of the array");
+  if (grain < 0) return THROW_ERROR("illegal argument #3: grain size should not be negative");
+
+  util::ParallelFor(reinterpret_cast<util::ParallelKernel>(FunctionPointer.Unwrap(args.This())->ptr()),
+                    data->GetIndexedPropertiesExternalArrayData(),
+                    begin,
+                    end,
+                    grain,
+                    data,
+                    v8::Handle<v8::Function>::Cast(callback));
+  return v8::Undefined();
+}
+
+
+// Shared objects are loaded with getPermanentLibrary: they are never unloaded
+// because FunctionPointers into them can outlive the wrapper.
+inline void* MakeDynamicLibrary(const v8::Arguments& args) {
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    THROW_ERROR("expected 1 argument: path to a shared library");
+    return NULL;
+  }
+
+  std::string errstr;
+  llvm::sys::DynamicLibrary lib =
+      llvm::sys::DynamicLibrary::getPermanentLibrary(*v8::String::Utf8Value(args[0]), &errstr);
+  if (!lib.isValid()) {
+    THROW_ERROR(errstr.c_str());
+    return NULL;
+  }
+  return new llvm::sys::DynamicLibrary(lib);
+}
+
+
+Wrapper<llvm::sys::DynamicLibrary, &MakeDynamicLibrary> DynamicLibrary;
+
+static v8::Handle<v8::Value> DynamicLibrary_getAddressOfSymbol(const v8::Arguments& args) {
+  if (args.Length() != 1 || !args[0]->IsString()) return THROW_ERROR("illegal argument #0: symbol name expected");
+  void* ptr = DynamicLibrary.Unwrap(args.This())->getAddressOfSymbol(*v8::String::AsciiValue(args[0]));
+  if (ptr == NULL) return v8::Null();
+  return FunctionPointer.Wrap(new util::FunctionPointer(ptr));
 }
@@ -0,0 +1,360 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef CODE_POOL_H
+#define CODE_POOL_H
+
+#include "llvm/Function.h"
+#include "llvm/ExecutionEngine/JITMemoryManager.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <sys/mman.h>
+
+#include <cassert>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace util {
+
+// Executable memory carved out of large arenas. Functions marked as hot are
+// placed into separate arenas so that frequently executed code is packed
+// densely and touches few (ideally huge) pages. Memory of freed functions is
+// coalesced and reused. Used by the JIT through PooledJITMemoryManager.
+class CodePool {
+ public:
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+  static const size_t kStubArenaSize = 64 * 1024;
+
+  CodePool(size_t arena_size, bool huge_pages)
+      : arena_size_(arena_size), huge_pages_(huge_pages), open_(NULL), open_size_(0) {
+  }
+
+  // Place code of F together with other hot functions. Must be called
+  // before F is compiled.
+  void markHot(const llvm::Function* F) { hot_.insert(F); }
+  bool isHot(const llvm::Function* F) const { return hot_.count(F) != 0; }
+
+  size_t arenaSize() const { return arena_size_; }
+  size_t arenaCount() const { return arenas_.size(); }
+
+  size_t hugePageArenaCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < arenas_.size(); i++) if (arenas_[i].huge) count++;
+    return count;
+  }
+
+  size_t reservedBytes() const {
+    size_t size = 0;
+    for (size_t i = 0; i < arenas_.size(); i++) size += arenas_[i].size;
+    return size;
+  }
+
+  // Bytes mapped for function bodies and for stubs respectively. Arenas for
+  // oversized functions are larger than arenaSize().
+  size_t codeReservedBytes() const { return ReservedBytes(false); }
+  size_t stubReservedBytes() const { return ReservedBytes(true); }
+
+  size_t usedBytes() const {
+    size_t size = 0;
+    for (BlockMap::const_iterator it = allocated_.begin(); it != allocated_.end(); ++it) {
+      size += it->second.size;
+    }
+    return size;
+  }
+
+  size_t freeBytes() const {
+    size_t size = 0;
+    for (int kind = 0; kind < kKindCount; kind++) {
+      for (FreeMap::const_iterator it = free_[kind].begin(); it != free_[kind].end(); ++it) {
+        size += it->second;
+      }
+    }
+    return size;
+  }
+
+  size_t functionCount() const {
+    size_t count = 0;
+    for (BlockMap::const_iterator it = allocated_.begin(); it != allocated_.end(); ++it) {
+      if (it->second.kind != kStubs) count++;
+    }
+    return count;
+  }
+
+ private:
+  friend class PooledJITMemoryManager;
+
+  enum Kind { kNormal, kHot, kStubs, kKindCount };
+
+  // Alignment of function bodies.
+  static const size_t kCodeAlignment = 16;
+
+  // Smallest region handed out for a function body when its size is unknown.
+  static const size_t kMinBodySize = 4 * 1024;
+
+  struct Arena {
+    uint8_t* base;
+    size_t size;
+    Kind kind;
+    bool huge;
+  };
+
+  struct Block {
+    size_t size;
+    Kind kind;
+  };
+
+  typedef std::map<uint8_t*, size_t> FreeMap;
+  typedef std::map<uint8_t*, Block> BlockMap;
+
+  static size_t RoundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+  size_t ReservedBytes(bool stubs) const {
+    size_t size = 0;
+    for (size_t i = 0; i < arenas_.size(); i++) {
+      if ((arenas_[i].kind == kStubs) == stubs) size += arenas_[i].size;
+    }
+    return size;
+  }
+
+  // Returns a region for a function body of unknown size: the largest free
+  // block of the given kind. |*size| is the number of bytes requested on
+  // input (0 if unknown) and available on output.
+  uint8_t* Open(Kind kind, uintptr_t* size) {
+    size_t min_size = kMinBodySize;
+    if (*size > min_size) min_size = *size;
+
+    FreeMap::iterator best = free_[kind].end();
+    for (FreeMap::iterator it = free_[kind].begin(); it != free_[kind].end(); ++it) {
+      if (best == free_[kind].end() || it->second > best->second) best = it;
+    }
+    if (best == free_[kind].end() || best->second < min_size) {
+      NewArena(kind, min_size);
+      return Open(kind, size);
+    }
+
+    open_ = best->first;
+    open_size_ = best->second;
+    open_kind_ = kind;
+    free_[kind].erase(best);
+
+    *size = open_size_;
+    return open_;
+  }
+
+  // Function occupies [start, end) of the open region, the rest is returned.
+  void Close(uint8_t* start, uint8_t* end) {
+    assert(start == open_);
+    size_t used = RoundUp(end - start, kCodeAlignment);
+    if (used > open_size_) used = open_size_;
+
+    Block block = { used, open_kind_ };
+    allocated_[start] = block;
+    if (used < open_size_) AddFree(open_kind_, start + used, open_size_ - used);
+    open_ = NULL;
+    open_size_ = 0;
+  }
+
+  uint8_t* Allocate(Kind kind, size_t size, size_t alignment) {
+    if (alignment == 0) alignment = 1;
+    for (FreeMap::iterator it = free_[kind].begin(); it != free_[kind].end(); ++it) {
+      uint8_t* start = reinterpret_cast<uint8_t*>(
+          RoundUp(reinterpret_cast<uintptr_t>(it->first), alignment));
+      if (start + size > it->first + it->second) continue;
+
+      uint8_t* block_start = it->first;
+      uint8_t* block_end = it->first + it->second;
+      free_[kind].erase(it);
+      if (start > block_start) AddFree(kind, block_start, start - block_start);
+      if (start + size < block_end) AddFree(kind, start + size, block_end - (start + size));
+
+      Block block = { size, kind };
+      allocated_[start] = block;
+      return start;
+    }
+
+    NewArena(kind, size + alignment);
+    return Allocate(kind, size, alignment);
+  }
+
+  void Free(void* ptr) {
+    BlockMap::iterator it = allocated_.find(static_cast<uint8_t*>(ptr));
+    if (it == allocated_.end()) return;
+    AddFree(it->second.kind, it->first, it->second.size);
+    allocated_.erase(it);
+  }
+
+  // Inserts a free block merging it with adjacent free blocks.
+  void AddFree(Kind kind, uint8_t* start, size_t size) {
+    FreeMap& free = free_[kind];
+    FreeMap::iterator next = free.lower_bound(start);
+    if (next != free.end() && start + size == next->first) {
+      size += next->second;
+      free.erase(next++);
+    }
+    if (next != free.begin()) {
+      FreeMap::iterator prev = next;
+      --prev;
+      if (prev->first + prev->second == start) {
+        prev->second += size;
+        return;
+      }
+    }
+    free[start] = size;
+  }
+
+  void NewArena(Kind kind, size_t min_size) {
+    size_t size = arena_size_;
+    if (kind == kStubs) size = kStubArenaSize;
+    if (size < min_size) size = RoundUp(min_size, kHugePageSize);
+
+    Arena arena = { NULL, size, kind, false };
+    arena.base = Map(size, huge_pages_ && kind != kStubs, &arena.huge);
+    if (arena.base == NULL) llvm::report_fatal_error("failed to allocate memory for JIT'd code");
+    arenas_.push_back(arena);
+    AddFree(kind, arena.base, size);
+  }
+
+  // Maps RWX memory preferring reserved huge pages and falling back to
+  // transparent huge pages when none are available.
+  static uint8_t* Map(size_t size, bool huge_pages, bool* huge) {
+    const int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+    *huge = false;
+#ifdef MAP_HUGETLB
+    if (huge_pages && size % kHugePageSize == 0) {
+      void* ptr = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (ptr != MAP_FAILED) {
+        *huge = true;
+        return static_cast<uint8_t*>(ptr);
+      }
+    }
+#endif
+    void* ptr = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return static_cast<uint8_t*>(ptr);
+  }
+
+  size_t arena_size_;
+  bool huge_pages_;
+  std::vector<Arena> arenas_;
+  FreeMap free_[kKindCount];
+  BlockMap allocated_;
+  std::set<const llvm::Function*> hot_;
+
+  // Region returned by Open that is being filled by the JIT.
+  uint8_t* open_;
+  size_t open_size_;
+  Kind open_kind_;
+};
+
+
+// JIT memory manager that takes function bodies and stubs from a CodePool.
+// Everything else (globals, GOT, MCJIT sections) is delegated to the default
+// memory manager.
+class PooledJITMemoryManager : public llvm::JITMemoryManager {
+ public:
+  explicit PooledJITMemoryManager(CodePool* pool)
+      : pool_(pool), fallback_(llvm::JITMemoryManager::CreateDefaultMemManager()) {
+  }
+
+  virtual ~PooledJITMemoryManager() { delete fallback_; }
+
+  // Arenas are always writable and executable.
+  virtual void setMemoryWritable() { fallback_->setMemoryWritable(); }
+  virtual void setMemoryExecutable() { fallback_->setMemoryExecutable(); }
+  virtual void setPoisonMemory(bool poison) { fallback_->setPoisonMemory(poison); }
+
+  virtual void AllocateGOT() {
+    fallback_->AllocateGOT();
+    HasGOT = true;
+  }
+
+  virtual uint8_t* getGOTBase() const { return fallback_->getGOTBase(); }
+
+  virtual uint8_t* startFunctionBody(const llvm::Function* F, uintptr_t& ActualSize) {
+    return pool_->Open(pool_->isHot(F) ? CodePool::kHot : CodePool::kNormal, &ActualSize);
+  }
+
+  virtual void endFunctionBody(const llvm::Function* F, uint8_t* FunctionStart, uint8_t* FunctionEnd) {
+    pool_->Close(FunctionStart, FunctionEnd);
+  }
+
+  virtual void deallocateFunctionBody(void* Body) { pool_->Free(Body); }
+
+  virtual uint8_t* allocateStub(const llvm::GlobalValue* F, unsigned StubSize, unsigned Alignment) {
+    return pool_->Allocate(CodePool::kStubs, StubSize, Alignment);
+  }
+
+  virtual uint8_t* allocateSpace(intptr_t Size, unsigned Alignment) {
+    return fallback_->allocateSpace(Size, Alignment);
+  }
+
+  virtual uint8_t* allocateGlobal(uintptr_t Size, unsigned Alignment) {
+    return fallback_->allocateGlobal(Size, Alignment);
+  }
+
+  virtual uint8_t* startExceptionTable(const llvm::Function* F, uintptr_t& ActualSize) {
+    return fallback_->startExceptionTable(F, ActualSize);
+  }
+
+  virtual void endExceptionTable(const llvm::Function* F, uint8_t* TableStart,
+                                 uint8_t* TableEnd, uint8_t* FrameRegister) {
+    fallback_->endExceptionTable(F, TableStart, TableEnd, FrameRegister);
+  }
+
+  virtual void deallocateExceptionTable(void* ET) { fallback_->deallocateExceptionTable(ET); }
+
+  virtual uint8_t* allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID) {
+    return fallback_->allocateCodeSection(Size, Alignment, SectionID);
+  }
+
+  virtual uint8_t* allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID) {
+    return fallback_->allocateDataSection(Size, Alignment, SectionID);
+  }
+
+  virtual void* getPointerToNamedFunction(const std::string& Name, bool AbortOnFailure = true) {
+    return fallback_->getPointerToNamedFunction(Name, AbortOnFailure);
+  }
+
+  // Slabs are the pool's arenas, which may be shared with other engines and
+  // vary in size: llvm.getMemoryStats() asks the pool instead.
+  virtual size_t GetDefaultCodeSlabSize() { return pool_->arenaSize(); }
+  virtual size_t GetDefaultDataSlabSize() { return fallback_->GetDefaultDataSlabSize(); }
+  virtual size_t GetDefaultStubSlabSize() { return CodePool::kStubArenaSize; }
+  virtual unsigned GetNumCodeSlabs() { return CountArenas(false); }
+  virtual unsigned GetNumDataSlabs() { return fallback_->GetNumDataSlabs(); }
+  virtual unsigned GetNumStubSlabs() { return CountArenas(true); }
+
+ private:
+  unsigned CountArenas(bool stubs) const {
+    unsigned count = 0;
+    for (size_t i = 0; i < pool_->arenas_.size(); i++) {
+      if ((pool_->arenas_[i].kind == CodePool::kStubs) == stubs) count++;
+    }
+    return count;
+  }
+
+  CodePool* pool_;
+  llvm::JITMemoryManager* fallback_;
+};
+
+}
+
+#endif
@@ -0,0 +1,145 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef EDGE_PROFILER_H
+#define EDGE_PROFILER_H
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/IRBuilder.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Metadata.h"
+#include "llvm/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <map>
+#include <vector>
+
+namespace util {
+
+// Collects execution counts of conditional branch edges and turns them into
+// branch weight metadata. A function is profiled through an instrumented
+// copy that increments a pair of counters (taken, not taken) before every
+// conditional branch. Conditional branches of the original function are
+// matched with counters by their order so the original has to stay
+// unchanged until it is annotated.
+class EdgeProfiler {
+ public:
+  EdgeProfiler() { }
+
+  ~EdgeProfiler() {
+    for (size_t i = 0; i < storage_.size(); i++) delete storage_[i];
+  }
+
+  // Returns an instrumented copy of F added to F's module.
+  llvm::Function* instrument(llvm::Function* F) {
+    llvm::ValueToValueMapTy vmap;
+    llvm::Function* clone = llvm::CloneFunction(F, vmap, false);
+    clone->setName(F->getName() + ".profiled");
+    F->getParent()->getFunctionList().push_back(clone);
+
+    std::vector<llvm::BranchInst*> branches;
+    CollectBranches(clone, &branches);
+
+    // JIT'd code refers to counters by address, so every instrumentation
+    // gets storage of its own that is never resized or freed while the
+    // profiler is alive: copies instrumented earlier may still be running.
+    // Instrumenting F again starts from zero counts.
+    std::vector<uint64_t>* storage = new std::vector<uint64_t>(branches.size() * 2, 0);
+    storage_.push_back(storage);
+    counters_[F] = storage;
+    std::vector<uint64_t>& counters = *storage;
+    if (counters.empty()) return clone;
+
+    llvm::LLVMContext& context = F->getContext();
+    llvm::Constant* base = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(llvm::Type::getInt64Ty(context),
+                               reinterpret_cast<uintptr_t>(&counters[0])),
+        llvm::Type::getInt64PtrTy(context));
+
+    for (size_t i = 0; i < branches.size(); i++) {
+      llvm::IRBuilder<> builder(branches[i]);
+      llvm::Value* idx = builder.CreateSelect(branches[i]->getCondition(),
+                                              builder.getInt32(2 * i),
+                                              builder.getInt32(2 * i + 1));
+      llvm::Value* counter = builder.CreateGEP(base, idx);
+      builder.CreateStore(builder.CreateAdd(builder.CreateLoad(counter), builder.getInt64(1)), counter);
+    }
+
+    return clone;
+  }
+
+  // Attaches branch weights collected by F's instrumented copy to F.
+  // Returns false if F was not instrumented.
+  bool annotate(llvm::Function* F) {
+    CounterMap::iterator it = counters_.find(F);
+    if (it == counters_.end()) return false;
+    const std::vector<uint64_t>& counters = *it->second;
+
+    std::vector<llvm::BranchInst*> branches;
+    CollectBranches(F, &branches);
+    if (branches.size() * 2 != counters.size()) return false;
+
+    llvm::LLVMContext& context = F->getContext();
+    for (size_t i = 0; i < branches.size(); i++) {
+      uint64_t taken = counters[2 * i];
+      uint64_t not_taken = counters[2 * i + 1];
+
+      // Weights are 32-bit. Scale both counts to preserve their ratio; add 1
+      // so that an edge that was never executed is unlikely but not impossible.
+      while (taken > 0xFFFFFFFEu || not_taken > 0xFFFFFFFEu) {
+        taken >>= 1;
+        not_taken >>= 1;
+      }
+
+      llvm::Value* weights[] = {
+        llvm::MDString::get(context, "branch_weights"),
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), taken + 1),
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), not_taken + 1)
+      };
+      branches[i]->setMetadata(llvm::LLVMContext::MD_prof, llvm::MDNode::get(context, weights));
+    }
+    return true;
+  }
+
+  // Counters of F: taken and not taken counts of every conditional branch.
+  const std::vector<uint64_t>* countersOf(const llvm::Function* F) const {
+    CounterMap::const_iterator it = counters_.find(F);
+    return it != counters_.end() ? it->second : NULL;
+  }
+
+ private:
+  typedef std::map<const llvm::Function*, std::vector<uint64_t>*> CounterMap;
+
+  EdgeProfiler(const EdgeProfiler&);
+  EdgeProfiler& operator=(const EdgeProfiler&);
+
+  static void CollectBranches(llvm::Function* F, std::vector<llvm::BranchInst*>* branches) {
+    for (llvm::Function::iterator BB = F->begin(); BB != F->end(); ++BB) {
+      llvm::BranchInst* branch = llvm::dyn_cast_or_null<llvm::BranchInst>(BB->getTerminator());
+      if (branch != NULL && branch->isConditional()) branches->push_back(branch);
+    }
+  }
+
+  // Counters of the latest instrumentation of each function.
+  CounterMap counters_;
+  // Every counter vector ever handed out, owned by the profiler.
+  std::vector<std::vector<uint64_t>*> storage_;
+};
+
+}
+
+#endif
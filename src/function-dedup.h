@@ -0,0 +1,181 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FUNCTION_DEDUP_H
+#define FUNCTION_DEDUP_H
+
+#include "llvm/Function.h"
+#include "llvm/Metadata.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <string>
+
+namespace util {
+
+// Maps structurally identical functions to a single copy of machine code.
+// Functions are compared by their printed IR with the function's own name
+// replaced by a fixed one, so two functions share code only if they are
+// identical up to their names. Only hashes of the printed IR are kept: on a
+// hash match the canonical function is printed again and compared in full,
+// so there are no false positives due to hash collisions.
+class FunctionDeduplicator {
+ public:
+  FunctionDeduplicator() : hits_(0) { }
+
+  // Structural key of F. F is renamed while it is printed so that references
+  // to itself (recursive calls) do not depend on its name either. Printed
+  // instructions only refer to attached metadata (!prof !3), so contents of
+  // the attachments are appended: functions that differ only in branch
+  // weights must not share code.
+  static std::string KeyOf(llvm::Function* F) {
+    std::string name = F->getName();
+    F->setName("node_llvm.dedup.canonical");
+
+    std::string key;
+    llvm::raw_string_ostream os(key);
+    F->print(os);
+
+    llvm::SmallVector<std::pair<unsigned, llvm::MDNode*>, 4> attachments;
+    for (llvm::inst_iterator I = llvm::inst_begin(F), E = llvm::inst_end(F); I != E; ++I) {
+      I->getAllMetadata(attachments);
+      for (unsigned i = 0; i < attachments.size(); i++) {
+        os << attachments[i].first << ' ';
+        attachments[i].second->print(os);
+        os << '\n';
+      }
+    }
+    os.flush();
+
+    F->setName(name);
+    return key;
+  }
+
+  // Returns code of a function with the given key or NULL.
+  void* Find(const std::string& key) {
+    std::pair<CodeMap::iterator, CodeMap::iterator> range = code_.equal_range(Hash(key));
+    for (CodeMap::iterator it = range.first; it != range.second; ++it) {
+      if (KeyOf(entries_[it->second].canonical) == key) {
+        hits_++;
+        return it->second;
+      }
+    }
+    return NULL;
+  }
+
+  // Records code compiled for canonical function F. F has to keep its body
+  // while it is canonical since its key is recomputed from it.
+  void Add(const std::string& key, llvm::Function* F, void* code) {
+    Entry& entry = entries_[code];
+    entry.hash = Hash(key);
+    entry.canonical = F;
+    code_.insert(std::make_pair(entry.hash, code));
+    canonical_[F] = code;
+  }
+  // Records that duplicate F was mapped to existing code.
+  void AddDuplicate(llvm::Function* F, void* code) {
+    duplicates_[F] = code;
+    entries_[code].users++;
+  }
+
+  bool IsDuplicate(const llvm::Function* F) const {
+    return duplicates_.find(F) != duplicates_.end();
+  }
+
+  // Called when machine code of F is about to be freed. Returns the function
+  // whose machine code can actually be freed now or NULL. Code of a
+  // canonical function is pinned while duplicates are mapped to it: it is
+  // freed together with the last duplicate, so the canonical function has
+  // to stay alive until then.
+  llvm::Function* Release(llvm::Function* F) {
+    std::map<const llvm::Function*, void*>::iterator dup = duplicates_.find(F);
+    if (dup != duplicates_.end()) {
+      void* code = dup->second;
+      duplicates_.erase(dup);
+      Entry& entry = entries_[code];
+      if (--entry.users > 0 || !entry.released) return NULL;
+      llvm::Function* canonical = entry.canonical;
+      Forget(code);
+      return canonical;
+    }
+
+    std::map<const llvm::Function*, void*>::iterator it = canonical_.find(F);
+    if (it == canonical_.end()) return F;
+
+    void* code = it->second;
+    Entry& entry = entries_[code];
+    // Code that is going away must not be handed to new duplicates.
+    Unlist(code);
+    if (entry.users > 0) {
+      entry.released = true;
+      return NULL;
+    }
+    Forget(code);
+    return F;
+  }
+
+  size_t size() const { return code_.size(); }
+  size_t hits() const { return hits_; }
+
+ private:
+  struct Entry {
+    Entry() : hash(0), canonical(NULL), users(0), released(false) { }
+
+    size_t hash;
+    llvm::Function* canonical;
+    size_t users;
+    // Canonical function was freed but duplicates still use its code.
+    bool released;
+  };
+
+  typedef std::multimap<size_t, void*> CodeMap;
+
+  static size_t Hash(const std::string& key) {
+    return llvm::hash_value(llvm::StringRef(key));
+  }
+
+  // Removes code from lookup by key.
+  void Unlist(void* code) {
+    std::pair<CodeMap::iterator, CodeMap::iterator> range = code_.equal_range(entries_[code].hash);
+    for (CodeMap::iterator it = range.first; it != range.second; ++it) {
+      if (it->second == code) {
+        code_.erase(it);
+        return;
+      }
+    }
+  }
+
+  void Forget(void* code) {
+    Entry& entry = entries_[code];
+    Unlist(code);
+    std::map<const llvm::Function*, void*>::iterator canonical = canonical_.find(entry.canonical);
+    if (canonical != canonical_.end() && canonical->second == code) canonical_.erase(canonical);
+    entries_.erase(code);
+  }
+
+  CodeMap code_;
+  std::map<void*, Entry> entries_;
+  std::map<const llvm::Function*, void*> canonical_;
+  std::map<const llvm::Function*, void*> duplicates_;
+  size_t hits_;
+};
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LAZY_COMPILATION_H
+#define LAZY_COMPILATION_H
+
+#include "llvm/Function.h"
+#include "llvm/GVMaterializer.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+
+#include <map>
+
+namespace util {
+
+// Materializer that runs a FunctionPassManager over a function right before
+// the JIT reads its body for the first time. Combined with lazy compilation
+// it defers both optimization and code generation of a function until
+// the first call through its stub.
+class LazyFunctionOptimizer : public llvm::GVMaterializer {
+ public:
+  // Return optimizer attached to the given module installing one if necessary.
+  static LazyFunctionOptimizer* For(llvm::Module* M) {
+    // Bindings never attach any other materializer to a module so whatever
+    // is attached was installed here. Module takes ownership of it.
+    if (M->getMaterializer() == NULL) M->setMaterializer(new LazyFunctionOptimizer());
+    return static_cast<LazyFunctionOptimizer*>(M->getMaterializer());
+  }
+
+  // Run given pass manager over F when F is about to be compiled.
+  void Defer(llvm::Function* F, llvm::FunctionPassManager* fpm) {
+    pending_[F] = fpm;
+  }
+
+  virtual bool isMaterializable(const llvm::GlobalValue* GV) const {
+    return pending_.count(GV) != 0;
+  }
+
+  virtual bool isDematerializable(const llvm::GlobalValue* GV) const {
+    return false;
+  }
+
+  virtual bool Materialize(llvm::GlobalValue* GV, std::string* ErrInfo = 0) {
+    PendingMap::iterator it = pending_.find(GV);
+    if (it == pending_.end()) return false;
+
+    // Remove the function first: FunctionPassManager::run materializes
+    // the function it is given.
+    llvm::FunctionPassManager* fpm = it->second;
+    pending_.erase(it);
+    fpm->run(*llvm::cast<llvm::Function>(GV));
+    return false;
+  }
+
+  virtual void Dematerialize(llvm::GlobalValue* GV) { }
+
+  virtual bool MaterializeModule(llvm::Module* M, std::string* ErrInfo = 0) {
+    while (!pending_.empty()) {
+      Materialize(const_cast<llvm::GlobalValue*>(pending_.begin()->first), ErrInfo);
+    }
+    return false;
+  }
+
+ private:
+  typedef std::map<const llvm::GlobalValue*, llvm::FunctionPassManager*> PendingMap;
+
+  PendingMap pending_;
+};
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <node.h>
+
+#include "llvm/Function.h"
+#include "llvm/Module.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITMemoryManager.h"
+
+#include "code-pool.h"
+
+#include <map>
+#include <vector>
+
+namespace util {
+
+// Rough estimate of memory occupied by the IR of a function.
+inline size_t EstimateFunctionSize(const llvm::Function* F) {
+  size_t size = sizeof(llvm::Function) + F->arg_size() * sizeof(llvm::Argument);
+  for (llvm::Function::const_iterator BB = F->begin(); BB != F->end(); ++BB) {
+    size += sizeof(llvm::BasicBlock);
+    for (llvm::BasicBlock::const_iterator I = BB->begin(); I != BB->end(); ++I) {
+      size += sizeof(llvm::Instruction) + I->getNumOperands() * sizeof(llvm::Use);
+    }
+  }
+  return size;
+}
+
+
+// Counts machine code emitted by an engine and reports it to V8 as external
+// memory as soon as it is emitted, including functions compiled lazily.
+class CodeSizeListener : public llvm::JITEventListener {
+ public:
+  CodeSizeListener() : code_size_(0) { }
+
+  virtual void NotifyFunctionEmitted(const llvm::Function& F,
+                                     void* Code,
+                                     size_t Size,
+                                     const EmittedFunctionDetails& Details) {
+    sizes_[Code] = Size;
+    code_size_ += Size;
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(static_cast<intptr_t>(Size));
+  }
+
+  virtual void NotifyFreeingMachineCode(void* OldPtr) {
+    std::map<void*, size_t>::iterator it = sizes_.find(OldPtr);
+    if (it == sizes_.end()) return;
+    code_size_ -= it->second;
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(-static_cast<intptr_t>(it->second));
+    sizes_.erase(it);
+  }
+
+  size_t code_size() const { return code_size_; }
+  size_t function_count() const { return sizes_.size(); }
+
+ private:
+  std::map<void*, size_t> sizes_;
+  size_t code_size_;
+};
+
+
+// Native memory owned by an ExecutionEngine: IR of its functions, emitted
+// machine code and slabs reserved by its memory manager. Reservations are
+// unknown (reported as 0) for engines created without an explicit engine kind
+// or code pool, see EngineBuilder_create. Code and stub memory of engines using a CodePool
+// belongs to the pool, which can be shared, and is not counted here.
+class EngineMemory {
+ public:
+  EngineMemory(llvm::ExecutionEngine* engine,
+               llvm::JITMemoryManager* memory_manager,
+               CodePool* code_pool)
+      : engine_(engine), memory_manager_(memory_manager), code_pool_(code_pool), ir_size_(0) {
+    engine->RegisterJITEventListener(&listener_);
+  }
+
+  // Covers functions that were handed to the engine, see ReportFunction.
+  size_t ir_size() const { return ir_size_; }
+
+  size_t code_size() const { return listener_.code_size(); }
+  size_t function_count() const { return listener_.function_count(); }
+
+  // Memory manager reserves code, stub and data memory in slabs.
+  size_t code_reserved() const {
+    if (memory_manager_ == NULL || code_pool_ != NULL) return 0;
+    return memory_manager_->GetNumCodeSlabs() * memory_manager_->GetDefaultCodeSlabSize();
+  }
+
+  size_t stub_reserved() const {
+    if (memory_manager_ == NULL || code_pool_ != NULL) return 0;
+    return memory_manager_->GetNumStubSlabs() * memory_manager_->GetDefaultStubSlabSize();
+  }
+
+  size_t data_reserved() const {
+    if (memory_manager_ == NULL) return 0;
+    return memory_manager_->GetNumDataSlabs() * memory_manager_->GetDefaultDataSlabSize();
+  }
+
+  // IR is not observable while it is being built so its size is sampled
+  // whenever a function is handed to the JIT. Only that function is walked:
+  // rescanning every module here made compiling N functions quadratic.
+  void ReportFunction(const llvm::Function* F) {
+    size_t& reported = function_sizes_[F];
+    size_t size = EstimateFunctionSize(F);
+    ReportIRGrowth(size, reported);
+    reported = size;
+  }
+
+  // Stops accounting for F, e.g. when its machine code is freed.
+  void ForgetFunction(const llvm::Function* F) {
+    std::map<const llvm::Function*, size_t>::iterator it = function_sizes_.find(F);
+    if (it == function_sizes_.end()) return;
+    ReportIRGrowth(0, it->second);
+    function_sizes_.erase(it);
+  }
+
+  CodePool* code_pool() const { return code_pool_; }
+
+  static EngineMemory* Register(llvm::ExecutionEngine* engine,
+                                llvm::JITMemoryManager* memory_manager,
+                                CodePool* code_pool) {
+    EngineMemory* memory = new EngineMemory(engine, memory_manager, code_pool);
+    engines().push_back(memory);
+    return memory;
+  }
+
+  static EngineMemory* For(llvm::ExecutionEngine* engine) {
+    for (size_t i = 0; i < engines().size(); i++) {
+      if (engines()[i]->engine_ == engine) return engines()[i];
+    }
+    return NULL;
+  }
+
+  // All engines in the order of creation.
+  static std::vector<EngineMemory*>& engines() {
+    static std::vector<EngineMemory*> engines;
+    return engines;
+  }
+
+ private:
+  llvm::ExecutionEngine* engine_;
+  llvm::JITMemoryManager* memory_manager_;
+  CodePool* code_pool_;
+  CodeSizeListener listener_;
+  std::map<const llvm::Function*, size_t> function_sizes_;
+  size_t ir_size_;
+
+  void ReportIRGrowth(size_t size, size_t old_size) {
+    ir_size_ += size - old_size;
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(
+        static_cast<intptr_t>(size) - static_cast<intptr_t>(old_size));
+  }
+};
+
+}
+
+#endif
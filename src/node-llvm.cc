@@ -16,8 +16,11 @@
 
 #include "generated-bindings.h"
 
+extern "C" void v8capi_init();
+
 static void Register(v8::Handle<v8::Object> exports) {
   v8::HandleScope scope;
+  v8capi_init();
   RegisterAllGeneratedBindings(exports);
 }
 
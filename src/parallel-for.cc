@@ -0,0 +1,223 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "parallel-for.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <deque>
+#include <vector>
+
+namespace util {
+
+// A single invocation of ParallelFor. Workers decrement |pending| as they
+// finish chunks, the last one wakes up the main thread through |async|.
+struct ParallelJob {
+  ParallelKernel kernel;
+  void* data;
+  volatile intptr_t pending;
+  uv_async_t async;
+  v8::Persistent<v8::Object> owner;
+  v8::Persistent<v8::Function> callback;
+};
+
+
+struct ParallelTask {
+  ParallelJob* job;
+  int64_t begin;
+  int64_t end;
+};
+
+
+// Every worker owns a deque of tasks. Workers take tasks from the back of
+// their own deque and steal from the front of other deques when it is empty.
+class WorkStealingPool {
+ public:
+  static WorkStealingPool* Get() {
+    static WorkStealingPool* pool = NULL;
+    if (pool == NULL) pool = new WorkStealingPool(NumberOfCPUs());
+    return pool;
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  // Distributes tasks round-robin across workers.
+  void Submit(const std::vector<ParallelTask>& tasks) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+      Worker* worker = workers_[next_++ % workers_.size()];
+      pthread_mutex_lock(&worker->lock);
+      worker->tasks.push_back(tasks[i]);
+      pthread_mutex_unlock(&worker->lock);
+    }
+
+    pthread_mutex_lock(&lock_);
+    available_ += tasks.size();
+    pthread_cond_broadcast(&wakeup_);
+    pthread_mutex_unlock(&lock_);
+  }
+
+ private:
+  struct Worker {
+    WorkStealingPool* pool;
+    size_t index;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    std::deque<ParallelTask> tasks;
+  };
+
+  static size_t NumberOfCPUs() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? static_cast<size_t>(n) : 1;
+  }
+
+  explicit WorkStealingPool(size_t size) : available_(0), next_(0) {
+    pthread_mutex_init(&lock_, NULL);
+    pthread_cond_init(&wakeup_, NULL);
+
+    for (size_t i = 0; i < size; i++) {
+      Worker* worker = new Worker();
+      worker->pool = this;
+      worker->index = i;
+      pthread_mutex_init(&worker->lock, NULL);
+      workers_.push_back(worker);
+    }
+
+    // Threads are started only after all deques exist because they steal
+    // from each other.
+    for (size_t i = 0; i < size; i++) {
+      pthread_create(&workers_[i]->thread, NULL, &WorkerMain, workers_[i]);
+    }
+  }
+
+  static void* WorkerMain(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    ParallelTask task;
+    while (true) {
+      worker->pool->WaitForTasks();
+      if (worker->pool->Take(worker, &task)) Run(task);
+    }
+    return NULL;
+  }
+
+  void WaitForTasks() {
+    pthread_mutex_lock(&lock_);
+    while (available_ == 0) pthread_cond_wait(&wakeup_, &lock_);
+    pthread_mutex_unlock(&lock_);
+  }
+
+  bool Take(Worker* self, ParallelTask* task) {
+    if (PopBack(self, task) || Steal(self, task)) {
+      __sync_fetch_and_sub(&available_, 1);
+      return true;
+    }
+    return false;
+  }
+
+  bool PopBack(Worker* worker, ParallelTask* task) {
+    pthread_mutex_lock(&worker->lock);
+    bool found = !worker->tasks.empty();
+    if (found) {
+      *task = worker->tasks.back();
+      worker->tasks.pop_back();
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+  }
+
+  bool Steal(Worker* self, ParallelTask* task) {
+    for (size_t i = 1; i < workers_.size(); i++) {
+      Worker* victim = workers_[(self->index + i) % workers_.size()];
+      pthread_mutex_lock(&victim->lock);
+      bool found = !victim->tasks.empty();
+      if (found) {
+        *task = victim->tasks.front();
+        victim->tasks.pop_front();
+      }
+      pthread_mutex_unlock(&victim->lock);
+      if (found) return true;
+    }
+    return false;
+  }
+
+  static void Run(const ParallelTask& task) {
+    ParallelJob* job = task.job;
+    job->kernel(job->data, task.begin, task.end);
+    if (__sync_sub_and_fetch(&job->pending, 1) == 0) uv_async_send(&job->async);
+  }
+
+  pthread_mutex_t lock_;
+  pthread_cond_t wakeup_;
+  volatile size_t available_;  // Number of queued tasks across all workers.
+  size_t next_;
+  std::vector<Worker*> workers_;
+};
+
+
+static void OnJobClosed(uv_handle_t* handle) {
+  delete static_cast<ParallelJob*>(handle->data);
+}
+
+
+static void OnJobDone(uv_async_t* async, int status) {
+  ParallelJob* job = static_cast<ParallelJob*>(async->data);
+
+  v8::HandleScope scope;
+  v8::Local<v8::Function> callback = v8::Local<v8::Function>::New(job->callback);
+  job->owner.Dispose();
+  job->callback.Dispose();
+  uv_close(reinterpret_cast<uv_handle_t*>(async), &OnJobClosed);
+
+  node::MakeCallback(v8::Context::GetCurrent()->Global(), callback, 0, NULL);
+}
+
+
+void ParallelFor(ParallelKernel kernel,
+                 void* data,
+                 int64_t begin,
+                 int64_t end,
+                 int64_t grain,
+                 v8::Handle<v8::Object> owner,
+                 v8::Handle<v8::Function> callback) {
+  WorkStealingPool* pool = WorkStealingPool::Get();
+
+  // By default give every worker a few chunks so that stealing can even out
+  // imbalance between them.
+  if (grain <= 0) grain = (end - begin) / static_cast<int64_t>(pool->size() * 4);
+  if (grain <= 0) grain = 1;
+
+  std::vector<ParallelTask> tasks;
+  ParallelJob* job = new ParallelJob();
+  for (int64_t from = begin; from < end; from += grain) {
+    ParallelTask task = { job, from, from + grain < end ? from + grain : end };
+    tasks.push_back(task);
+  }
+
+  job->kernel = kernel;
+  job->data = data;
+  job->pending = tasks.size();
+  job->owner = v8::Persistent<v8::Object>::New(owner);
+  job->callback = v8::Persistent<v8::Function>::New(callback);
+  uv_async_init(uv_default_loop(), &job->async, &OnJobDone);
+  job->async.data = job;
+
+  if (tasks.empty()) {
+    uv_async_send(&job->async);
+  } else {
+    pool->Submit(tasks);
+  }
+}
+
+}
@@ -0,0 +1,42 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <node.h>
+
+#include <stdint.h>
+
+namespace util {
+
+// Signature of JIT'd kernels: process elements [begin, end) of |data|.
+typedef void (*ParallelKernel)(void* data, int64_t begin, int64_t end);
+
+// Splits [begin, end) into chunks of at most |grain| elements and runs
+// |kernel| over them on a pool of worker threads. Returns immediately;
+// |callback| is invoked on the main thread once all chunks have finished.
+// |owner| is the object that owns |data| and is kept alive until then.
+void ParallelFor(ParallelKernel kernel,
+                 void* data,
+                 int64_t begin,
+                 int64_t end,
+                 int64_t grain,
+                 v8::Handle<v8::Object> owner,
+                 v8::Handle<v8::Function> callback);
+
+}
+
+#endif
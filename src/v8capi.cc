@@ -14,9 +14,22 @@
 
 #include <node.h>
 
+#include <vector>
+
 #define V8CAPI extern "C"
 #define ARGS(v) reinterpret_cast<v8::Arguments*>(v)
 
+// Instance type of heap numbers. Generated code compares it with the instance
+// type stored in an object's map to check that the object is a heap number.
+V8CAPI { uint8_t v8capi_heap_number_type = 0; }
+
+V8CAPI void v8capi_init() {
+  v8::HandleScope scope;
+  v8::Handle<v8::Value> number = v8::Number::New(0.5);
+  v8capi_heap_number_type = static_cast<uint8_t>(v8::internal::Internals::GetInstanceType(
+      *reinterpret_cast<v8::internal::Object**>(*number)));
+}
+
 V8CAPI int v8capi_argc(void* p) {
   return ARGS(p)->Length();
 }
@@ -26,7 +39,31 @@ V8CAPI void* v8capi_arg(void* p, uint32_t idx) {
   return reinterpret_cast<void*>(*arg);
 }
 
+// Generated code tags Smis in-line and calls this only for values that need
+// a heap number.
 V8CAPI void* v8capi_new_number(double val) {
   v8::Handle<v8::Value> arg = v8::Number::New(val);
   return reinterpret_cast<void*>(*arg);
 }
+
+// Called by generated code when one of its speculative guards fails. Invokes
+// the generic fallback passed to FunctionPointer.toJSFunction with the same
+// receiver and arguments. Returns NULL if an exception is pending.
+V8CAPI void* v8capi_bailout(void* p) {
+  const v8::Arguments& args = *ARGS(p);
+
+  v8::Handle<v8::Value> data = args.Data();
+  if (data.IsEmpty() || !data->IsFunction()) {
+    v8::ThrowException(v8::Exception::Error(v8::String::New("speculation failed and no fallback was given")));
+    return NULL;
+  }
+
+  int argc = args.Length();
+  std::vector<v8::Handle<v8::Value> > argv(argc);
+  for (int i = 0; i < argc; i++) argv[i] = args[i];
+
+  v8::Handle<v8::Value> result =
+      v8::Handle<v8::Function>::Cast(data)->Call(args.This(), argc, argc > 0 ? &argv[0] : NULL);
+  if (result.IsEmpty()) return NULL;
+  return reinterpret_cast<void*>(*result);
+}
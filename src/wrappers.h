@@ -17,8 +17,6 @@
 
 #include <node.h>
 
-#include <cassert>
-
 class WrapperBase {
  public:
   typedef void* (*CtorCallback) (const v8::Arguments& args);
@@ -91,7 +89,8 @@ class WrapperTypedBase : public WrapperBase {
       return NULL;
     }
 
-    assert(template_->HasInstance(value));
+    // Unchecked: receivers of bound methods are checked by V8 against their
+    // signatures (see BIND_INSTANCE_METHOD), arguments are checked with Is.
     return static_cast<T*>(v8::Handle<v8::Object>::Cast(value)->GetPointerFromInternalField(0));
   }
 };
@@ -100,6 +99,17 @@ class WrapperTypedBase : public WrapperBase {
 inline void* DummyCtorCallback(const v8::Arguments& args) { return NULL; }
 
 
+// Approximate amount of native memory owned by an object of type T created
+// from JS. It is reported to V8 when the object is created so that GC takes
+// native allocations into account. Wrappers never delete native objects (see
+// Dtor) so the memory stays reported after the wrapper dies. Specialize for
+// types that own much more than sizeof(T).
+template<typename T>
+struct ExternalSize {
+  static const int value = sizeof(T);
+};
+
+
 template<typename T, WrapperBase::CtorCallback ctor = &DummyCtorCallback>
 class Wrapper : public WrapperTypedBase<T> {
  public:
@@ -110,6 +120,8 @@ class Wrapper : public WrapperTypedBase<T> {
   static void Dtor(v8::Persistent<v8::Value> obj, void* ptr) {
     obj.Dispose();
     obj.Clear();
+    // Memory reported by Ctor is released only when the object is actually
+    // deleted, which does not happen yet.
     // TODO(vegorov): some types (e.g. Passes) have "external" ownership after
     // they were added somewhere so automatic deletion does not work.
     // delete static_cast<T*>(ptr);
@@ -127,6 +139,7 @@ class Wrapper : public WrapperTypedBase<T> {
       v8::Persistent<v8::Value> weak = v8::Persistent<v8::Value>::New(args.This());
       weak.MakeWeak(obj, Dtor);
       weak.MarkIndependent();
+      v8::V8::AdjustAmountOfExternalAllocatedMemory(ExternalSize<T>::value);
       return args.This();
     }
   }